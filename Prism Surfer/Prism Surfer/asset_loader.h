@@ -0,0 +1,201 @@
+#ifndef __ASSET_LOADER_H__
+#define __ASSET_LOADER_H__
+#pragma once
+
+#include "cgmath.h"
+#include "cgut.h"
+#include "render_device.h"
+#include "glstate.h"
+#include "texture_cooker.h"
+#include "asset_pack.h"
+#include "profiler.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <chrono>
+
+// asynchronous asset loader: the file work (mapping cooked textures, cooking the
+// stale ones, reading whole files) runs on a pool of workers in the order the
+// assets were added; finished assets wait until the main thread calls upload(),
+// which creates the GL objects and runs each asset's callback.
+// - with a pack, assets are views into it; those missing from it come from loose files.
+// - add every asset before start(); ids are indices in the order of addition.
+// - wait(id) blocks until one asset is in, uploading whatever else is ready meanwhile.
+// - a texture layer is cooked to the array's size and uploaded into the array's layer.
+struct asset_loader_t
+{
+	enum kind_t { TEXTURE, TEXTURE_LAYER, FILE_DATA };
+	enum state_t { QUEUED, FAILED, DONE };
+
+	struct asset_t
+	{
+		int		kind;
+		std::string	path;
+		bool	alpha = false;				// textures: keep an alpha channel
+		ivec2	fit = ivec2(0, 0);			// texture layers: the array's size
+		int		layer = -1;
+		std::function<bool(asset_t&)>	done;	// main thread, after the upload; false fails the asset
+		cooked_texture_t	texture;		// mapped until the upload
+		GLuint	name = 0;					// the created texture, or the array of a layer
+		std::vector<uchar>	data;			// whole-file contents read from a loose file
+		const uchar*	bytes = nullptr;	// the file's contents: a view into the pack, or data's buffer
+		size_t	size = 0;
+		double	load_ms = 0;
+		bool	ok = false;					// set by the worker
+		int		state = QUEUED;				// main thread only
+	};
+
+	std::deque<asset_t>	assets;			// stable addresses for the workers
+	const asset_pack_t*	pack = nullptr;	// consulted before loose files
+	std::vector<std::thread>	workers;
+	std::mutex	mutex;
+	std::condition_variable	cv;			// signals the main thread that an asset is loaded
+	std::function<void()>	wake;		// also called on the worker, e.g., to post an empty window event
+	std::deque<int>	jobs;
+	std::vector<int>	loaded, taken;	// loaded: ready for upload; taken: the upload's scratch
+	uint	remaining = 0;				// assets not uploaded yet
+	uint	failures = 0;
+	std::chrono::steady_clock::time_point	start_time;
+
+	~asset_loader_t() { for (auto& t : workers) t.join(); }	// an early exit still lets the workers finish
+	int add_texture(const char* source, bool alpha, std::function<bool(asset_t&)> done);
+	int add_texture_layer(const char* source, GLuint array, int layer, ivec2 size, std::function<bool(asset_t&)> done);	// RGBA
+	int add_file(const char* path, std::function<bool(asset_t&)> done);
+	void start(int thread_count = 0);
+	uint upload(int only = -1);			// uploads what is ready, or just one asset if it is; returns the count
+	bool wait(int id);					// false if the asset failed; uploads nothing else
+	bool finish();						// waits for everything; false if anything failed
+	bool pending() const { return remaining > 0; }
+
+protected:
+	void run();
+	void load(asset_t& a);
+};
+
+inline int asset_loader_t::add_texture(const char* source, bool alpha, std::function<bool(asset_t&)> done)
+{
+	assets.emplace_back();
+	asset_t& a = assets.back(); a.kind = TEXTURE; a.path = source; a.alpha = alpha; a.done = done;
+	return int(assets.size()) - 1;
+}
+
+inline int asset_loader_t::add_texture_layer(const char* source, GLuint array, int layer, ivec2 size, std::function<bool(asset_t&)> done)
+{
+	assets.emplace_back();
+	asset_t& a = assets.back(); a.kind = TEXTURE_LAYER; a.path = source; a.alpha = true; a.fit = size; a.name = array; a.layer = layer; a.done = done;
+	return int(assets.size()) - 1;
+}
+
+inline int asset_loader_t::add_file(const char* path, std::function<bool(asset_t&)> done)
+{
+	assets.emplace_back();
+	asset_t& a = assets.back(); a.kind = FILE_DATA; a.path = path; a.done = done;
+	return int(assets.size()) - 1;
+}
+
+inline void asset_loader_t::start(int thread_count)
+{
+	start_time = std::chrono::steady_clock::now();
+	for (int k = 0; k < int(assets.size()); k++) jobs.push_back(k);
+	remaining = uint(assets.size());
+	if (thread_count <= 0) thread_count = clamp(int(std::thread::hardware_concurrency()), 1, 4);
+	for (int k = 0; k < thread_count && k < int(assets.size()); k++) workers.emplace_back(&asset_loader_t::run, this);
+}
+
+inline void asset_loader_t::run()
+{
+	PROFILE_THREAD("asset loader");
+	for (;;)
+	{
+		int id;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (jobs.empty()) return;
+			id = jobs.front(); jobs.pop_front();
+		}
+		load(assets[id]);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			loaded.push_back(id);
+		}
+		cv.notify_one();
+		if (wake) wake();
+	}
+}
+
+inline void asset_loader_t::load(asset_t& a)
+{
+	PROFILE_ZONE("load asset");
+	auto t0 = std::chrono::steady_clock::now();
+	bool ok = false;
+	size_t n = 0;
+	const uchar* p = pack ? pack->find(a.path.c_str(), n) : nullptr;
+	if (a.kind != FILE_DATA) ok = (p && a.texture.view(p, n, a.alpha ? 4 : 3, a.fit)) || open_cooked_texture(a.texture, a.path.c_str(), a.alpha, a.fit);
+	else if (p) { a.bytes = p; a.size = n; ok = true; }
+	else if (FILE* fp = fopen(a.path.c_str(), "rb"))
+	{
+		fseek(fp, 0, SEEK_END); long m = ftell(fp); fseek(fp, 0, SEEK_SET);
+		if (m > 0) { a.data.resize(size_t(m)); ok = fread(&a.data[0], size_t(m), 1, fp) == 1; }
+		if (ok) { a.bytes = &a.data[0]; a.size = a.data.size(); }
+		fclose(fp);
+	}
+	if (!ok) printf("%s(): unable to load %s\n", __func__, a.path.c_str());
+	a.load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+	a.ok = ok;
+}
+
+inline uint asset_loader_t::upload(int only)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (only < 0) taken.swap(loaded);
+		else { auto it = std::find(loaded.begin(), loaded.end(), only); if (it != loaded.end()) { taken.push_back(only); loaded.erase(it); } }
+	}
+	render_device_t& rd = render_device_t::current();
+	for (int id : taken)
+	{
+		asset_t& a = assets[id];
+		if (a.ok && a.kind == TEXTURE) a.name = rd.create_texture_levels(a.texture.size(), a.texture.channels(), a.texture.levels(), a.texture.pixels());
+		if (a.ok && a.kind == TEXTURE_LAYER) { rd.bind_texture_array(a.name); rd.texture_layer(a.layer, a.texture.size(), a.texture.levels(), a.texture.pixels()); }
+		if (a.ok && a.done) a.ok = a.done(a);
+		a.texture.file.close();
+		a.state = a.ok ? DONE : FAILED;
+		if (!a.ok) failures++;
+		remaining--;
+	}
+	uint n = uint(taken.size());
+	taken.clear();
+	if (n) gl_state_t::instance().invalidate();	// the uploads bind around the state cache
+	if (n && !remaining)
+	{
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count(), sum = 0;
+		for (auto& a : assets) sum += a.load_ms;
+		printf("assets: %zu in %.1f ms on %zu workers (%.1f ms of file work)%s\n", assets.size(), ms, workers.size(), sum, failures ? ", some failed" : "");
+	}
+	return n;
+}
+
+inline bool asset_loader_t::wait(int id)
+{
+	for (;;)
+	{
+		upload(id);
+		if (assets[id].state == DONE || assets[id].state == FAILED) return assets[id].state == DONE;
+		std::unique_lock<std::mutex> lock(mutex);
+		cv.wait(lock, [this, id]() { return std::find(loaded.begin(), loaded.end(), id) != loaded.end(); });
+	}
+}
+
+inline bool asset_loader_t::finish()
+{
+	for (int k = 0; k < int(assets.size()); k++) wait(k);
+	for (auto& t : workers) t.join();
+	workers.clear();
+	assets.clear();
+	return failures == 0;
+}
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef __ASSET_PACK_H__
+#define __ASSET_PACK_H__
+#pragma once
+
+#include "cgmath.h"
+#include "cgut.h"
+#include "texture_cooker.h"
+#if defined(PRISM_EMBED_PACK) && defined(_WIN32)
+	#include "resource.h"
+#endif
+
+// asset pack (assets.pack): every file the game loads at startup, behind a table of
+// contents sorted by name, so startup I/O is one mapping and lookups hand out views.
+// - names are the paths the game asks for ("textures/title.jpg", "font/LBRITE.TTF");
+//   a texture's entry holds its cooked form (.ptex), anything else the file itself.
+// - file layout (native endianness): magic "PSPACK02", uint32 count, uint32 reserved,
+//   count entries, then the data, each entry at a 16-byte aligned offset.
+// - an entry records the size and time of its source (the file under its name) at cook
+//   time. a pack found in the working directory is a development one: when a source there
+//   differs, find() passes on the entry, so the loose file (and for a texture, a fresh .ptex)
+//   wins. embedded and executable-side packs are trusted as they are, without a stat.
+// - with PRISM_EMBED_PACK defined, the pack is linked into the executable: as an RCDATA
+//   resource on Windows (see the .rc file), with .incbin of PRISM_PACK_PATH on GCC, which
+//   the build sets to an absolute path; run --cook before building.
+struct asset_pack_t
+{
+	struct header_t { char magic[8]; uint count, reserved; };
+	struct entry_t { char name[48]; uint64_t offset, size; uint64_t source_size; int64_t source_time; };
+
+	mapped_file_t	file;
+	const uchar*	data = nullptr;
+	size_t			size = 0;
+	const entry_t*	entries = nullptr;
+	uint			count = 0;
+	std::string		source;			// where the pack came from, for the log
+	bool			check_sources = false;	// compare entries with the files under their names
+
+	bool open();						// embedded, then next to the executable, then the working directory
+	bool open(const char* path);
+	bool view(const uchar* p, size_t n);
+	const uchar* find(const char* name, size_t& n) const;	// nullptr if absent or stale
+};
+
+inline bool asset_pack_t::view(const uchar* p, size_t n)
+{
+	const header_t* h = (const header_t*)p;
+	if (!p || n < sizeof(header_t) || memcmp(h->magic, "PSPACK02", 8) != 0 || n < sizeof(header_t) + sizeof(entry_t) * h->count) return false;
+	const entry_t* e = (const entry_t*)(h + 1);
+	for (uint k = 0; k < h->count; k++) if (e[k].offset > n || e[k].size > n - e[k].offset || e[k].name[sizeof(e[k].name) - 1]) return false;
+	data = p; size = n; entries = e; count = h->count;
+	return true;
+}
+
+inline bool asset_pack_t::open(const char* path)
+{
+	if (!file.open(path)) return false;
+	if (!view(file.data, file.size)) { printf("%s(): %s is not an asset pack\n", __func__, path); file.close(); return false; }
+	source = path;
+	return true;
+}
+
+inline const uchar* asset_pack_t::find(const char* name, size_t& n) const
+{
+	const entry_t* e = std::lower_bound(entries, entries + count, name, [](const entry_t& a, const char* b) { return strcmp(a.name, b) < 0; });
+	if (e == entries + count || strcmp(e->name, name) != 0) return nullptr;
+	uint64_t source_size; int64_t source_time;
+	if (check_sources && source_stat(name, source_size, source_time) && (source_size != e->source_size || source_time != e->source_time))
+	{
+		printf("%s(): %s changed since %s was cooked; loading it instead (run --cook to update)\n", __func__, name, source.c_str());
+		return nullptr;
+	}
+	n = size_t(e->size);
+	return data + e->offset;
+}
+
+// directory of the running executable, with a trailing separator; empty if unknown
+inline std::string executable_dir()
+{
+	char path[1024] = { 0 };
+#if defined(_WIN32)
+	DWORD n = GetModuleFileNameA(nullptr, path, sizeof(path));
+	if (!n || n >= sizeof(path)) return "";
+#else
+	ssize_t n = readlink("/proc/self/exe", path, sizeof(path) - 1);
+	if (n <= 0) return "";
+	path[n] = 0;
+#endif
+	std::string p = path;
+	size_t slash = p.find_last_of("/\\");
+	return slash == std::string::npos ? "" : p.substr(0, slash + 1);
+}
+
+#if defined(PRISM_EMBED_PACK) && defined(__GNUC__) && !defined(_WIN32)
+#ifndef PRISM_PACK_PATH
+#define PRISM_PACK_PATH "assets.pack"	// relative to the assembler's working directory
+#endif
+__asm__(".section .rodata\n.balign 16\n.global prism_asset_pack\nprism_asset_pack:\n.incbin \"" PRISM_PACK_PATH "\"\n.global prism_asset_pack_end\nprism_asset_pack_end:\n.previous\n");
+extern "C" const uchar prism_asset_pack[], prism_asset_pack_end[];
+#endif
+
+inline bool asset_pack_t::open()
+{
+#if defined(PRISM_EMBED_PACK) && defined(_WIN32)
+	if (HRSRC r = FindResourceA(nullptr, MAKEINTRESOURCEA(IDR_ASSET_PACK), MAKEINTRESOURCEA(10)))	// 10: RT_RCDATA
+		if (HGLOBAL g = LoadResource(nullptr, r))
+			if (view((const uchar*)LockResource(g), size_t(SizeofResource(nullptr, r)))) { source = "(embedded)"; return true; }
+#elif defined(PRISM_EMBED_PACK) && defined(__GNUC__)
+	if (view(prism_asset_pack, size_t(prism_asset_pack_end - prism_asset_pack))) { source = "(embedded)"; return true; }
+#endif
+	std::string dir = executable_dir();
+	if (!dir.empty() && open((dir + "assets.pack").c_str())) return true;
+	return check_sources = open("assets.pack");
+}
+
+// writes a pack of the given (name, file) pairs; the names need not be sorted
+inline bool write_asset_pack(const char* path, std::vector<std::pair<std::string, std::string>> items)
+{
+	std::sort(items.begin(), items.end());
+	std::vector<asset_pack_t::entry_t> entries(items.size());
+	std::vector<std::vector<uchar>> contents(items.size());
+	uint64_t offset = sizeof(asset_pack_t::header_t) + sizeof(asset_pack_t::entry_t) * items.size();
+	for (size_t k = 0; k < items.size(); k++)
+	{
+		asset_pack_t::entry_t& e = entries[k];
+		if (items[k].first.size() >= sizeof(e.name)) { printf("%s(): name too long: %s\n", __func__, items[k].first.c_str()); return false; }
+		mapped_file_t f;
+		uint64_t file_size = 0; int64_t file_time = 0;
+		if (!f.open(items[k].second.c_str()) && !(source_stat(items[k].second.c_str(), file_size, file_time) && !file_size)) { printf("%s(): unable to read %s\n", __func__, items[k].second.c_str()); return false; }	// an empty file does not map
+		contents[k].assign(f.data, f.data + f.size);
+		memset(e.name, 0, sizeof(e.name)); memcpy(e.name, items[k].first.c_str(), items[k].first.size());
+		offset = (offset + 15) & ~uint64_t(15);
+		e.offset = offset; e.size = f.size;
+		if (!source_stat(items[k].first.c_str(), e.source_size, e.source_time)) { printf("%s(): unable to stat %s\n", __func__, items[k].first.c_str()); return false; }
+		offset += f.size;
+	}
+
+	FILE* fp = fopen(path, "wb");
+	if (!fp) { printf("%s(): unable to create %s\n", __func__, path); return false; }
+	asset_pack_t::header_t header = { { 'P', 'S', 'P', 'A', 'C', 'K', '0', '2' }, uint(items.size()), 0 };
+	bool b = fwrite(&header, sizeof(header), 1, fp) == 1 && (entries.empty() || fwrite(&entries[0], sizeof(entries[0]) * entries.size(), 1, fp) == 1);
+	static const uchar zero[16] = { 0 };
+	for (size_t k = 0; b && k < items.size(); k++)
+	{
+		long pad = long(entries[k].offset) - ftell(fp);
+		b = (pad <= 0 || fwrite(zero, size_t(pad), 1, fp) == 1) && (contents[k].empty() || fwrite(&contents[k][0], contents[k].size(), 1, fp) == 1);
+	}
+	b = fclose(fp) == 0 && b;
+	if (!b) { printf("%s(): unable to write %s\n", __func__, path); remove(path); }
+	return b;
+}
+
+#endif
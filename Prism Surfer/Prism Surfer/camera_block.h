@@ -0,0 +1,53 @@
+#ifndef __CAMERA_BLOCK_H__
+#define __CAMERA_BLOCK_H__
+#pragma once
+
+#include "cgmath.h"
+#include "cgut.h"
+#include "render_device.h"
+
+// per-frame camera constants in one uniform buffer, shared by every program that declares
+//   layout(std140, row_major) uniform camera { mat4 view_matrix; mat4 projection_matrix; mat4 view_projection_matrix; };
+// row_major takes cgmath's matrices as they are stored, and std140 packs three mat4 without padding.
+// - the buffer stays on binding point BINDING; attach() points a linked program's block at it.
+// - update() uploads only when a matrix has changed since the last upload.
+struct camera_block_t
+{
+	static constexpr GLuint BINDING = 0;
+	struct data_t { mat4 view_matrix, projection_matrix, view_projection_matrix; };
+	static_assert(sizeof(data_t) == 3 * 64, "std140 layout of the camera block");
+
+	GLuint	buffer = 0;
+	data_t	data;
+	bool	valid = false;		// data is in the buffer
+	uint	uploads = 0;
+
+	void init();
+	void finalize() { render_device_t::current().destroy(render_device_t::BUFFER, buffer); buffer = 0; valid = false; }
+	void attach(GLuint program) const { render_device_t::current().uniform_block_binding(program, "camera", BINDING); }
+	void update(const mat4& view_matrix, const mat4& projection_matrix);
+};
+
+inline void camera_block_t::init()
+{
+	render_device_t& rd = render_device_t::current();
+	buffer = rd.create_buffer(GL_UNIFORM_BUFFER, sizeof(data_t), nullptr, GL_DYNAMIC_DRAW);
+	rd.bind_buffer_base(GL_UNIFORM_BUFFER, BINDING, buffer);
+	valid = false;
+}
+
+inline void camera_block_t::update(const mat4& view_matrix, const mat4& projection_matrix)
+{
+	if (valid && memcmp(&data.view_matrix, &view_matrix, sizeof(mat4)) == 0 && memcmp(&data.projection_matrix, &projection_matrix, sizeof(mat4)) == 0) return;
+	data.view_matrix = view_matrix;
+	data.projection_matrix = projection_matrix;
+	data.view_projection_matrix = projection_matrix * view_matrix;
+
+	render_device_t& rd = render_device_t::current();
+	rd.bind_buffer(GL_UNIFORM_BUFFER, buffer);
+	rd.buffer_sub_data(GL_UNIFORM_BUFFER, 0, sizeof(data_t), &data);
+	valid = true;
+	uploads++;
+}
+
+#endif
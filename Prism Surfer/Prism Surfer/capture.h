@@ -0,0 +1,247 @@
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+#pragma once
+
+#include "cgmath.h"
+#include "cgut.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+
+// assume stb_image_write.h included before this header
+
+// asynchronous frame recorder: every presented frame is read into a ring of
+// pixel-pack buffers and mapped RING-1 frames later, when the copy has long
+// finished, so the render loop never waits on a readback. a worker thread
+// encodes the frames to a PNG sequence (<path>/frame_00000.png, ...) or to a
+// raw YUV 4:2:0 stream when the path ends with ".y4m".
+// - PNG frames are independent and spread over several workers at a fast compression level.
+// - when the workers fall behind by MAX_PENDING frames, a real-time recording drops new
+//   frames; an offline one (headless, on a virtual clock) waits for a worker instead.
+// - a Y4M stream keeps the first frame size; frames of another size are dropped.
+// - a Y4M stream is 60 Hz: a frame is placed by its presentation time, and the gaps that
+//   static screens (which present only on events) and dropped frames leave are filled by
+//   repeating the frame before them.
+struct frame_capture_t
+{
+	enum format_t { PNG, Y4M };
+	static constexpr int RING = 3;
+	static constexpr int MAX_PENDING = 8;
+	static constexpr int STREAM_HZ = 60;
+
+	struct job_t { uint index; double time; ivec2 size; std::vector<uchar> rgba; };
+
+	bool	active = false;
+	bool	offline = false;		// wait for the workers rather than drop frames
+	int		format = PNG;
+	std::string	path;
+	ivec2	size;					// size of the buffers in the ring
+	ivec2	stream_size;			// Y4M frame size; zero until the header is written
+	GLuint	pbo[RING] = { 0 };
+	GLsync	fence[RING] = { 0 };
+	double	time[RING] = { 0 };		// presentation time of the frame in each slot
+	uint	issued = 0;				// frames read into the ring since the last resize
+	uint	sequence = 0;			// frame number of the next retired frame
+	std::atomic<uint>	written{ 0 }, dropped{ 0 }, repeated{ 0 };
+	FILE*	y4m = nullptr;
+	double	stream_start = 0;		// presentation time of the stream's first frame
+	uint	stream_frames = 0;		// frames in the stream, repeats included
+	std::vector<uchar>	last_yuv;	// the stream's last frame, for repeats
+
+	std::vector<std::thread>	workers;
+	std::mutex	mutex;
+	std::condition_variable	cv;
+	std::condition_variable	space;	// signaled when a worker takes a job
+	std::deque<job_t>	jobs;
+	std::vector<std::vector<uchar>>	spare;	// recycled frame buffers
+	bool	quit = false;
+
+	bool begin(const char* output_path, bool offline_clock = false);
+	void capture(ivec2 frame_size, double presentation_time);	// call after rendering, before the buffer swap; time in seconds
+	void end();
+
+protected:
+	void resize(ivec2 frame_size);
+	void retire(int slot);			// maps a finished slot and queues it for the worker
+	void drain() { for (uint k = issued > RING ? issued - RING : 0; k < issued; k++) retire(k % RING); }
+	void run();
+	void write_png(job_t& job);
+	void write_y4m(const job_t& job);
+};
+
+inline bool frame_capture_t::begin(const char* output_path, bool offline_clock)
+{
+	path = output_path;
+	offline = offline_clock;
+	format = path.size() > 4 && path.compare(path.size() - 4, 4, ".y4m") == 0 ? Y4M : PNG;
+	if (format == Y4M && !(y4m = fopen(path.c_str(), "wb"))) { printf("%s(): unable to open %s\n", __func__, path.c_str()); return false; }
+
+	glGenBuffers(RING, pbo);
+	quit = false;
+	uint n = format == Y4M ? 1 : clamp(std::thread::hardware_concurrency() / 2, 1u, 4u);	// a stream must stay in order
+	if (format == PNG) stbi_write_png_compression_level = 2;
+	for (uint k = 0; k < n; k++) workers.emplace_back(&frame_capture_t::run, this);
+	printf("recording frames to %s\n", path.c_str());
+	return active = true;
+}
+
+inline void frame_capture_t::resize(ivec2 frame_size)
+{
+	drain();
+	issued = 0;
+	size = frame_size;
+	for (int k = 0; k < RING; k++)
+	{
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[k]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, size_t(size.x) * size.y * 4, nullptr, GL_STREAM_READ);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+inline void frame_capture_t::retire(int slot)
+{
+	if (!fence[slot]) return;
+	glClientWaitSync(fence[slot], GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+	glDeleteSync(fence[slot]); fence[slot] = 0;
+
+	size_t bytes = size_t(size.x) * size.y * 4;
+	std::vector<uchar> buffer;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		if (offline) space.wait(lock, [this] { return jobs.size() < MAX_PENDING; });
+		else if (jobs.size() >= MAX_PENDING) { sequence++; dropped++; return; }
+		if (!spare.empty()) { buffer.swap(spare.back()); spare.pop_back(); }
+	}
+	buffer.resize(bytes);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[slot]);
+	if (void* p = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT)) { memcpy(&buffer[0], p, bytes); glUnmapBuffer(GL_PIXEL_PACK_BUFFER); }
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back({ sequence++, time[slot], size, std::move(buffer) });
+	}
+	cv.notify_one();
+}
+
+inline void frame_capture_t::capture(ivec2 frame_size, double presentation_time)
+{
+	if (!active || frame_size.x <= 0 || frame_size.y <= 0) return;
+	if (frame_size.x != size.x || frame_size.y != size.y) resize(frame_size);
+
+	// the slot written RING frames ago is reused: hand its pixels over first
+	int slot = int(issued % RING);
+	if (issued >= RING) retire(slot);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[slot]);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadPixels(0, 0, size.x, size.y, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	fence[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	time[slot] = presentation_time;
+	issued++;
+}
+
+inline void frame_capture_t::end()
+{
+	if (!active) return;
+	drain();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	cv.notify_all();
+	for (auto& w : workers) w.join();
+	workers.clear();
+
+	glDeleteBuffers(RING, pbo);
+	if (y4m) { fclose(y4m); y4m = nullptr; }
+	printf("recorded %u frames to %s (%u dropped", written.load(), path.c_str(), dropped.load());
+	if (format == Y4M) printf(", %u repeated to hold %d Hz", repeated.load(), STREAM_HZ);
+	printf(")\n");
+	active = false;
+}
+
+inline void frame_capture_t::run()
+{
+	for (;;)
+	{
+		job_t job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cv.wait(lock, [this] { return quit || !jobs.empty(); });
+			if (jobs.empty()) return;	// quit with nothing left
+			job = std::move(jobs.front()); jobs.pop_front();
+		}
+		space.notify_one();
+
+		if (format == PNG) write_png(job);
+		else write_y4m(job);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		spare.push_back(std::move(job.rgba));
+	}
+}
+
+inline void frame_capture_t::write_png(job_t& job)
+{
+	// drop alpha in place (blending leaves it partial), then write bottom-up rows with a negative stride
+	uchar* p = &job.rgba[0];
+	size_t n = size_t(job.size.x) * job.size.y;
+	for (size_t k = 0; k < n; k++) { p[k * 3 + 0] = p[k * 4 + 0]; p[k * 3 + 1] = p[k * 4 + 1]; p[k * 3 + 2] = p[k * 4 + 2]; }
+
+	char name[32]; snprintf(name, sizeof(name), "/frame_%05u.png", job.index);
+	int stride = job.size.x * 3;
+	if (stbi_write_png((path + name).c_str(), job.size.x, job.size.y, 3, p + size_t(stride) * (job.size.y - 1), -stride)) written++;
+	else { printf("%s(): failed to write %s%s\n", __func__, path.c_str(), name); dropped++; }
+}
+
+inline void frame_capture_t::write_y4m(const job_t& job)
+{
+	// 4:2:0 needs even dimensions; an odd last row/column is cropped
+	if (!stream_size.x)
+	{
+		stream_size = ivec2(job.size.x & ~1, job.size.y & ~1);
+		fprintf(y4m, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", stream_size.x, stream_size.y, STREAM_HZ);
+		stream_start = job.time;
+	}
+	if ((job.size.x & ~1) != stream_size.x || (job.size.y & ~1) != stream_size.y) { dropped++; return; }
+
+	// the frame's place at the stream rate; one that lands on a place already taken takes the next
+	uint place = uint(max((job.time - stream_start) * STREAM_HZ + 0.5, 0.0));
+	for (; stream_frames < place; stream_frames++, repeated++) { fputs("FRAME\n", y4m); fwrite(&last_yuv[0], 1, last_yuv.size(), y4m); }
+
+	// full-range BT.601; chroma from the average of each 2x2 block
+	int w = stream_size.x, h = stream_size.y;
+	std::vector<uchar>& yuv = last_yuv;
+	yuv.resize(size_t(w) * h * 3 / 2);
+	uchar *Y = &yuv[0], *U = Y + w * h, *V = U + (w / 2) * (h / 2);
+	const uchar* src = &job.rgba[0];
+	for (int y = 0; y < h; y++)
+	{
+		const uchar* row = src + size_t(job.size.x) * 4 * (job.size.y - 1 - y);	// GL rows are bottom-up
+		for (int x = 0; x < w; x++) { const uchar* c = row + x * 4; Y[y * w + x] = uchar(0.299f * c[0] + 0.587f * c[1] + 0.114f * c[2] + 0.5f); }
+	}
+	for (int y = 0; y < h / 2; y++)
+	{
+		const uchar* r0 = src + size_t(job.size.x) * 4 * (job.size.y - 1 - y * 2);
+		const uchar* r1 = r0 - size_t(job.size.x) * 4;
+		for (int x = 0; x < w / 2; x++)
+		{
+			const uchar *a = r0 + x * 8, *b = a + 4, *c = r1 + x * 8, *d = c + 4;
+			float r = (a[0] + b[0] + c[0] + d[0]) * 0.25f, g = (a[1] + b[1] + c[1] + d[1]) * 0.25f, bl = (a[2] + b[2] + c[2] + d[2]) * 0.25f;
+			U[y * (w / 2) + x] = uchar(clamp(128.0f - 0.168736f * r - 0.331264f * g + 0.5f * bl + 0.5f, 0.0f, 255.0f));
+			V[y * (w / 2) + x] = uchar(clamp(128.0f + 0.5f * r - 0.418688f * g - 0.081312f * bl + 0.5f, 0.0f, 255.0f));
+		}
+	}
+	fputs("FRAME\n", y4m);
+	fwrite(&yuv[0], 1, yuv.size(), y4m);
+	stream_frames++;
+	written++;
+}
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef __DYNAMIC_RESOLUTION_H__
+#define __DYNAMIC_RESOLUTION_H__
+#pragma once
+
+#include "cgmath.h"
+#include "cgut.h"
+
+#include <chrono>
+
+// dynamic resolution: the scene renders at a fraction of the window size (the scale),
+// chosen from the GPU time of recent frames, and is upscaled to the window under the HUD.
+// - GPU time comes from GL_TIME_ELAPSED queries in a small ring, read back a few frames
+//   late without stalling; while no result is in, the scale stays where it is.
+// - software GL rasterizes on CPU threads at the flush, after the queries have closed, so
+//   there each frame ends in a fence, and the next frame waits on it. the frame's time is what
+//   the fence holds up: its flush (where llvmpipe rasterizes), and if it is still busy once
+//   the next frame is built, all the time up to its signal. one frame stays in flight.
+// - the scale moves in steps of 1/STEPS, so the render target pool sees a handful of sizes:
+//   it drops at once to what the measured time asks for (pixels scale with its square),
+//   climbs one step at a time with headroom, and waits SETTLE results after each change.
+// - without automatic, the scale stays where it was set and no queries are made.
+struct resolution_scaler_t
+{
+	static constexpr int QUERY_NUM = 4;
+	static constexpr int STEPS = 20;			// the scale is steps / STEPS
+	static constexpr int MIN_STEPS = 10;
+	static constexpr uint SETTLE = 20;
+
+	bool	automatic = false;
+	int		steps = STEPS;
+	float	target_ms = 1000.0f / 60 * 0.85f;	// GPU budget of a frame, short of the refresh interval
+	double	gpu_ms = 0;							// smoothed; 0 until the first result
+	GLuint	queries[QUERY_NUM] = { 0 };
+	uint	issued = 0, read = 0;				// queries begun, results taken
+	bool	timing = false;						// a query is open
+	bool	fence_timed = false;				// software GL: time the fence of the previous frame
+	GLsync	fence = 0;
+	double	flush_ms = 0;						// spent creating and flushing the fence
+	std::chrono::steady_clock::time_point	fenced;	// when the fence was flushed
+	uint	settle = 0;
+
+	// metrics since reset()
+	uint	frames = 0, changes = 0, samples = 0;
+	int		min_steps = STEPS;
+	double	scale_sum = 0, gpu_sum = 0;
+
+	void init(bool automatic_scale, float fixed_scale = 1.0f);	// automatic needs a GL context
+	void finalize();
+	float scale() const { return float(steps) / STEPS; }
+	void begin_frame();
+	void end_frame();						// closes this frame's query and adapts to the results that are in
+	void reset() { frames = changes = samples = 0; min_steps = steps; scale_sum = gpu_sum = 0; }
+	void print(FILE* fp = stdout) const;
+
+protected:
+	void adapt(double ms);
+	void wait_fence();
+};
+
+inline void resolution_scaler_t::init(bool automatic_scale, float fixed_scale)
+{
+	automatic = automatic_scale;
+	steps = clamp(int(fixed_scale * STEPS + 0.5f), MIN_STEPS, STEPS);
+	if (automatic) glGenQueries(QUERY_NUM, queries);
+	const char* renderer = automatic ? (const char*)glGetString(GL_RENDERER) : nullptr;
+	fence_timed = renderer && (strstr(renderer, "llvmpipe") || strstr(renderer, "softpipe") || strstr(renderer, "SwiftShader"));
+	reset();
+}
+
+inline void resolution_scaler_t::finalize()
+{
+	if (automatic) glDeleteQueries(QUERY_NUM, queries);
+	if (fence) glDeleteSync(fence);
+	fence = 0;
+	automatic = false;
+}
+
+inline void resolution_scaler_t::begin_frame()
+{
+	// a full ring (the GPU is QUERY_NUM frames behind) leaves this frame untimed
+	if (fence_timed) return;
+	timing = automatic && issued - read < QUERY_NUM;
+	if (timing) glBeginQuery(GL_TIME_ELAPSED, queries[issued % QUERY_NUM]);
+}
+
+inline void resolution_scaler_t::end_frame()
+{
+	if (automatic && fence_timed) wait_fence();
+	if (timing) { glEndQuery(GL_TIME_ELAPSED); issued++; timing = false; }
+	while (read < issued)
+	{
+		GLuint q = queries[read % QUERY_NUM], available = 0;
+		glGetQueryObjectuiv(q, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) break;
+		GLuint64 ns = 0; glGetQueryObjectui64v(q, GL_QUERY_RESULT, &ns);
+		read++;
+		adapt(ns / 1e6);
+	}
+	frames++;
+	scale_sum += scale();
+	min_steps = min(min_steps, steps);
+}
+
+inline void resolution_scaler_t::wait_fence()
+{
+	typedef std::chrono::steady_clock steady_t;
+	if (fence)
+	{
+		double ms = flush_ms;
+		if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+		{
+			glClientWaitSync(fence, 0, GLuint64(1e9));
+			ms += std::chrono::duration<double, std::milli>(steady_t::now() - fenced).count();
+		}
+		glDeleteSync(fence);
+		adapt(ms);
+	}
+	steady_t::time_point t0 = steady_t::now();
+	fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glFlush();
+	fenced = steady_t::now();
+	flush_ms = std::chrono::duration<double, std::milli>(fenced - t0).count();
+}
+
+inline void resolution_scaler_t::adapt(double ms)
+{
+	gpu_ms = gpu_ms > 0 ? gpu_ms * 0.8 + ms * 0.2 : ms;
+	samples++; gpu_sum += ms;
+	if (settle) { settle--; return; }
+
+	int s = steps;
+	if (gpu_ms > target_ms) s = min(int(steps * sqrt(target_ms / gpu_ms)), steps - 1);	// floor: at least one step down
+	else if (gpu_ms < target_ms * 0.7) s = steps + 1;	// one step up adds at most 21% of the pixels
+	s = clamp(s, MIN_STEPS, STEPS);
+	if (s == steps) return;
+
+	// the results still in flight were rendered at the old scale; expect the new one
+	gpu_ms *= double(s * s) / double(steps * steps);
+	steps = s;
+	settle = SETTLE;
+	changes++;
+}
+
+inline void resolution_scaler_t::print(FILE* fp) const
+{
+	if (!frames) return;
+	fprintf(fp, "resolution scale: %.2f now, %.2f avg, %.2f min, %u changes", scale(), scale_sum / frames, float(min_steps) / STEPS, changes);
+	if (samples) fprintf(fp, "; GPU %.2f ms per frame (target %.2f)", gpu_sum / samples, target_ms);
+	fputc('\n', fp);
+}
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef __FRAME_GRAPH_H__
+#define __FRAME_GRAPH_H__
+#pragma once
+
+#include "cgmath.h"
+#include "cgut.h"
+#include "glstate.h"
+#include "pass_timer.h"
+#include "profiler.h"
+
+#include <functional>
+
+// pooled offscreen targets (RGBA8 color texture, optional depth) for transient use within a frame.
+// a target unused for MAX_IDLE frames is released, e.g., after a resize or when its pass stops running.
+struct render_target_pool_t
+{
+	static constexpr uint MAX_IDLE = 120;
+
+	struct target_t { GLuint framebuffer, color; ivec2 size; bool depth, busy; uint idle; };
+	std::vector<target_t>	targets;
+
+	int acquire(ivec2 size, bool depth);
+	void release(int k) { targets[k].busy = false; }
+	void end_frame();
+	void clear();
+};
+
+inline int render_target_pool_t::acquire(ivec2 size, bool depth)
+{
+	for (int k = 0; k < int(targets.size()); k++)
+	{
+		target_t& t = targets[k];
+		if (!t.busy && t.size.x == size.x && t.size.y == size.y && t.depth == depth) { t.busy = true; t.idle = 0; return k; }
+	}
+	target_t t = { 0, 0, size, depth, true, 0 };
+	t.framebuffer = render_device_t::current().create_render_target(size, depth, t.color);
+	gl_state_t::instance().invalidate();	// the creation binds around the cache
+	targets.push_back(t);
+	return int(targets.size()) - 1;
+}
+
+inline void render_target_pool_t::end_frame()
+{
+	for (size_t k = 0; k < targets.size();)
+	{
+		target_t& t = targets[k];
+		if (t.busy || ++t.idle <= MAX_IDLE) { t.busy = false; k++; continue; }
+		render_device_t::current().destroy(render_device_t::FRAMEBUFFER, t.framebuffer);
+		targets.erase(targets.begin() + k);
+	}
+}
+
+inline void render_target_pool_t::clear()
+{
+	for (auto& t : targets) render_device_t::current().destroy(render_device_t::FRAMEBUFFER, t.framebuffer);
+	targets.clear();
+}
+
+// frame graph: render passes are declared once, with the targets they read (sample)
+// and write, and run in declaration order. every frame, compile()
+// - drops inactive passes, then passes whose writes reach neither the backbuffer nor a later pass,
+// - maps each transient target either onto the backbuffer (when it may present and nothing
+//   samples it, so the usual path draws straight to the screen) or onto a pooled target,
+// - returns pooled targets after their last use, so targets with disjoint lifetimes alias.
+// a pass draws into the first target it writes, with the viewport covering it; compile() and
+// execute() allocate nothing once the pool has warmed up. with a timer, each pass is a zone of it.
+// - a transient may be scaled relative to the frame (e.g., for dynamic resolution); a pass
+//   that samples it brings it back to full size, so it never collapses onto the backbuffer.
+struct frame_graph_t
+{
+	static constexpr int BACKBUFFER = 0;
+
+	struct resource_t { const char* name; bool depth, may_present; int target, first, last; bool sampled; float scale; };	// target: pool index, -1 on the backbuffer
+	struct pass_t { const char* name; std::vector<int> reads, writes; std::function<bool()> active; std::function<void()> execute; bool live; };
+
+	std::vector<resource_t>	resources = { { "backbuffer", true, true, -1, 0, 0, false, 1.0f } };
+	std::vector<pass_t>		passes;
+	render_target_pool_t	pool;
+	std::vector<uchar>		wanted;		// scratch: resources some live pass still needs
+	std::vector<int>		releases;	// scratch: resources to return after each pass
+	uint	live_passes = 0;
+	pass_timer_t*	timer = nullptr;	// times each live pass as a zone, when set
+	ivec2	size;						// of the backbuffer, as of compile()
+
+	int add_target(const char* name, bool depth, bool may_present = false) { resources.push_back({ name, depth, may_present, -1, 0, 0, false, 1.0f }); return int(resources.size()) - 1; }
+	void set_scale(int r, float scale) { resources[r].scale = scale; }	// of the frame size; takes effect at the next compile()
+	void add_pass(const char* name, std::vector<int> reads, std::vector<int> writes, std::function<void()> execute, std::function<bool()> active = nullptr) { passes.push_back({ name, reads, writes, active, execute, false }); }
+	void compile(ivec2 size);
+	void execute();
+	void finalize() { pool.clear(); }
+
+	bool on_backbuffer(int r) const { return resources[r].target < 0; }
+	GLuint texture(int r) const { return on_backbuffer(r) ? 0 : pool.targets[resources[r].target].color; }	// color of a transient to sample
+	ivec2 target_size(int r) const { return on_backbuffer(r) ? size : pool.targets[resources[r].target].size; }
+	ivec2 scaled_size(int r) const { const resource_t& e = resources[r]; return ivec2(max(int(size.x * e.scale + 0.5f), 1), max(int(size.y * e.scale + 0.5f), 1)); }
+
+protected:
+	GLuint framebuffer(int r) const { return on_backbuffer(r) ? 0 : pool.targets[resources[r].target].framebuffer; }
+};
+
+inline void frame_graph_t::compile(ivec2 frame_size)
+{
+	size = frame_size;
+
+	// walk back from the backbuffer: a pass lives if a later live pass samples what it writes
+	wanted.assign(resources.size(), 0);
+	for (size_t r = 0; r < resources.size(); r++) { resources[r].sampled = false; resources[r].target = -1; wanted[r] = r == BACKBUFFER || resources[r].may_present; }
+	live_passes = 0;
+	for (int p = int(passes.size()) - 1; p >= 0; p--)
+	{
+		pass_t& pass = passes[p];
+		pass.live = !pass.active || pass.active();
+		if (pass.live) { bool w = false; for (int r : pass.writes) w = w || wanted[r]; pass.live = w; }
+		if (!pass.live) continue;
+		for (int r : pass.reads) { wanted[r] = 1; resources[r].sampled = true; }
+		live_passes++;
+	}
+
+	// lifetimes of the transients that stay offscreen
+	for (size_t r = 1; r < resources.size(); r++) { resources[r].first = INT_MAX; resources[r].last = -1; }
+	for (int p = 0; p < int(passes.size()); p++)
+	{
+		if (!passes[p].live) continue;
+		for (auto* list : { &passes[p].reads, &passes[p].writes }) for (int r : *list)
+		{
+			if (r == BACKBUFFER || (resources[r].may_present && !resources[r].sampled && resources[r].scale == 1.0f)) continue;
+			resources[r].first = min(resources[r].first, p); resources[r].last = max(resources[r].last, p);
+		}
+	}
+
+	// acquire at the first use, release after the last
+	for (int p = 0; p < int(passes.size()); p++)
+	{
+		releases.clear();
+		for (size_t r = 1; r < resources.size(); r++)
+		{
+			if (resources[r].first == p) resources[r].target = pool.acquire(scaled_size(int(r)), resources[r].depth);
+			if (resources[r].last == p) releases.push_back(int(r));
+		}
+		for (int r : releases) pool.release(resources[r].target);
+	}
+}
+
+inline void frame_graph_t::execute()
+{
+	gl_state_t& gs = gl_state_t::instance();
+	for (pass_t& pass : passes)
+	{
+		if (!pass.live) continue;
+		gs.bind_framebuffer(pass.writes.empty() ? 0 : framebuffer(pass.writes[0]));
+		gs.viewport(pass.writes.empty() ? size : target_size(pass.writes[0]));
+		PROFILE_ZONE(pass.name);
+		if (timer) timer->begin(pass.name);
+		pass.execute();
+		if (timer) timer->end();
+	}
+	gs.bind_framebuffer(0);
+	gs.viewport(size);
+	pool.end_frame();
+}
+
+#endif
@@ -0,0 +1,157 @@
+#ifndef __FRAME_PACER_H__
+#define __FRAME_PACER_H__
+#pragma once
+
+#include "cgmath.h"
+#include "cgut.h"
+#if defined(_WIN32)
+	#include <windows.h>
+	#pragma comment(lib, "winmm.lib")	// timeBeginPeriod()
+#endif
+
+#include <chrono>
+#include <thread>
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+// frame pacing of the game loop, which advances the game once per frame at a fixed rate:
+// - VSYNC: swaps wait for the vertical blank; with a refresh rate that is a multiple of the
+//   frame rate, the swap interval alone paces the frames. otherwise the limiter runs as well.
+// - ADAPTIVE: as VSYNC, but a late frame is shown at once (tearing) instead of waiting for
+//   another blank, where the driver supports it (EXT_swap_control_tear); VSYNC otherwise.
+// - LIMITER: no vsync; wait() sleeps on a high-resolution OS timer until shortly before the
+//   deadline and spins only for the last SPIN seconds.
+// deadlines advance by whole periods, so a short oversleep does not drift the frame rate;
+// a frame that falls more than a period behind (a stall, a pause) restarts the schedule.
+// intervals between the returns of wait() make up the jitter statistics.
+struct frame_pacer_t
+{
+	enum mode_t { VSYNC, ADAPTIVE, LIMITER, MODE_NUM };
+	static const char* mode_name(int m) { static const char* names[MODE_NUM] = { "vsync", "adaptive", "limiter" }; return m >= 0 && m < MODE_NUM ? names[m] : "?"; }
+	static constexpr double SPIN = 0.0005;
+	static constexpr int HISTORY = 1024;		// intervals kept for the percentiles
+
+	typedef std::chrono::steady_clock steady_t;
+	int		mode = LIMITER;
+	double	period = 1.0 / 60;
+	int		swap_interval = 0;
+	bool	limit = true;				// wait() sleeps to the deadline
+	steady_t::time_point	deadline, last;
+	bool	started = false;
+#if defined(_WIN32)
+	HANDLE	timer = nullptr;
+	bool	coarse = false;				// no high-resolution timer: raised the system timer resolution instead
+#endif
+
+	// statistics since reset(), in seconds
+	uint	count = 0, late = 0;		// late: intervals over 1.5 periods
+	double	sum = 0, sum2 = 0, min_interval = 0, max_interval = 0;
+	float	history[HISTORY];
+
+	bool init(int pacing_mode, double frames_per_second, int refresh_rate);	// the window's context must be current
+	void finalize();
+	void wait();						// returns when the next frame is due
+	void restart() { started = false; }	// after a deliberate break, e.g., a pause waiting on events
+	void reset() { count = late = 0; sum = sum2 = min_interval = max_interval = 0; }
+	void print(FILE* fp = stdout) const;
+	static void sleep(double seconds);	// the OS sleep, at its own resolution
+
+protected:
+	void sleep_until(steady_t::time_point t);
+};
+
+inline bool frame_pacer_t::init(int pacing_mode, double frames_per_second, int refresh_rate)
+{
+	mode = pacing_mode;
+	period = 1.0 / frames_per_second;
+
+	// swaps pace the frames only if each frame spans a whole number of blanks
+	int blanks = refresh_rate > 0 ? int(refresh_rate / frames_per_second + 0.5) : 0;
+	bool whole = blanks >= 1 && fabs(refresh_rate - blanks * frames_per_second) < 0.5;
+	if (mode == ADAPTIVE && !glfwExtensionSupported("WGL_EXT_swap_control_tear") && !glfwExtensionSupported("GLX_EXT_swap_control_tear")) mode = VSYNC;
+	swap_interval = mode == LIMITER ? 0 : whole ? blanks : 1;
+	if (mode == ADAPTIVE) swap_interval = -swap_interval;
+	limit = mode == LIMITER || !whole;
+	glfwSwapInterval(swap_interval);
+
+#if defined(_WIN32)
+	// a high-resolution waitable timer (Windows 10 1803 and later) wakes within about 0.5 ms;
+	// before that, waits are only as precise as the system timer, so raise it to 1 ms
+	timer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+	if (!timer) { timer = CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS); coarse = timeBeginPeriod(1) == TIMERR_NOERROR; }
+	if (!timer) { printf("%s(): unable to create a waitable timer\n", __func__); return false; }
+#endif
+	started = false;
+	reset();
+	return true;
+}
+
+inline void frame_pacer_t::finalize()
+{
+#if defined(_WIN32)
+	if (timer) CloseHandle(timer);
+	if (coarse) timeEndPeriod(1);
+	timer = nullptr; coarse = false;
+#endif
+}
+
+inline void frame_pacer_t::sleep(double seconds)
+{
+	if (seconds <= 0) return;
+#if defined(_WIN32)
+	Sleep(DWORD(seconds * 1000));
+#else
+	std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+#endif
+}
+
+inline void frame_pacer_t::sleep_until(steady_t::time_point t)
+{
+	// sleep off all but the last SPIN seconds, then spin to the deadline
+	double s = std::chrono::duration<double>(t - steady_t::now()).count() - SPIN;
+	if (s > 0)
+	{
+#if defined(_WIN32)
+		LARGE_INTEGER due; due.QuadPart = -LONGLONG(s * 1e7);	// relative, in 100 ns units
+		if (SetWaitableTimer(timer, &due, 0, nullptr, nullptr, FALSE)) WaitForSingleObject(timer, INFINITE);
+#else
+		std::this_thread::sleep_for(std::chrono::duration<double>(s));	// nanosleep on CLOCK_MONOTONIC
+#endif
+	}
+	while (steady_t::now() < t) std::this_thread::yield();
+}
+
+inline void frame_pacer_t::wait()
+{
+	auto step = std::chrono::duration_cast<steady_t::duration>(std::chrono::duration<double>(period));
+	steady_t::time_point now = steady_t::now();
+	if (!started) { deadline = now; last = now; started = true; return; }
+
+	deadline += step;
+	if (now > deadline + step) deadline = now;		// too far behind to catch up; start over
+	else if (limit) { sleep_until(deadline); now = steady_t::now(); }
+
+	double interval = std::chrono::duration<double>(now - last).count();
+	last = now;
+	history[count % HISTORY] = float(interval);
+	min_interval = count ? min(min_interval, interval) : interval;
+	max_interval = count ? max(max_interval, interval) : interval;
+	sum += interval; sum2 += interval * interval;
+	if (interval > period * 1.5) late++;
+	count++;
+}
+
+inline void frame_pacer_t::print(FILE* fp) const
+{
+	if (!count) return;
+	uint n = min(count, uint(HISTORY));
+	std::vector<float> h(history, history + n);
+	std::sort(h.begin(), h.end());
+	double mean = sum / count, var = max(sum2 / count - mean * mean, 0.0);
+	fprintf(fp, "frame pacing (%s, swap interval %d%s): %.3f ms avg, %.3f ms std dev, %.3f min, %.3f max, %.3f 99th percentile; %u of %u frames late\n",
+		mode_name(mode), swap_interval, limit && mode != LIMITER ? ", limiter" : "", mean * 1000, sqrt(var) * 1000, min_interval * 1000, max_interval * 1000, h[size_t((n - 1) * 0.99)] * 1000, late, count);
+}
+
+#endif
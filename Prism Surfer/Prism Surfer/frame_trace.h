@@ -0,0 +1,458 @@
+#ifndef __FRAME_TRACE_H__
+#define __FRAME_TRACE_H__
+#pragma once
+
+#include "cgmath.h"
+#include "cgut.h"
+#include "render_device.h"
+
+#include <chrono>
+#include <map>
+#include <set>
+
+// single-frame traces of the render device stream, replayable without the game.
+// a trace holds a prologue, which recreates the resources the frame refers to and
+// restores the bound state, followed by the commands of one frame.
+// file layout (native endianness): magic "PSTRACE1", uint32 frame_first, uint32 reserved,
+// uint64 command count, uint64 payload size, the command_t array, then the payload.
+struct frame_trace_t
+{
+	typedef record_device_t::command_t command_t;
+
+	std::vector<command_t>	commands;
+	std::vector<uchar>		payload;
+	uint	frame_first = 0;		// commands before this one form the prologue
+
+	bool save(const char* path) const;
+	bool load(const char* path);
+	void replay(render_device_t& rd, int loops) const;	// prints per-frame and per-call timings
+};
+
+// device that keeps a shadow of the resources and state it has seen, so a
+// capture can start at any frame boundary; it records only while capturing.
+struct trace_device_t : public record_device_t
+{
+	struct buffer_t { GLenum target, usage; std::vector<uchar> data; };
+	struct texture_t { ivec2 size; int channels; bool mipmap; int levels, layers; std::vector<uchar> pixels; };	// rows 4-byte aligned; levels > 0: all of them in pixels, for each layer of an array (layers > 0)
+	struct sampler_t { GLenum min_filter, mag_filter, wrap; };
+	struct value_t { uint op; std::vector<uchar> data; };
+	struct program_t { std::string sources; uint vert_size; std::map<std::string, GLint> locations; std::map<GLint, value_t> uniforms; std::map<std::string, GLuint> blocks; };	// blocks: uniform block bindings
+	struct vertex_array_t { GLuint vertex_buffer, index_buffer; GLsizei stride; std::vector<vertex_attrib_t> attribs; };
+	struct render_target_t { ivec2 size; bool depth; GLuint color; };	// contents are not kept
+
+	std::map<GLuint, buffer_t>		buffers;
+	std::map<GLuint, texture_t>		textures;
+	std::map<GLuint, sampler_t>		samplers;
+	std::map<GLuint, program_t>		programs;
+	std::map<GLuint, vertex_array_t>	vertex_arrays;
+	std::map<GLuint, render_target_t>	render_targets;
+
+	// bound and fixed-function state; unset entries were never touched
+	GLuint	program = 0, vertex_array = 0, array_buffer = 0, element_buffer = 0, uniform_buffer = 0, unit = 0, framebuffer = 0;
+	std::map<GLuint, GLuint>	unit_texture, unit_texture_array, unit_sampler;
+	std::map<GLuint, GLuint>	uniform_bindings;	// indexed GL_UNIFORM_BUFFER binding points
+	std::map<GLenum, bool>		caps;
+	std::map<GLenum, GLint>		pixel_stores;
+	std::vector<command_t>		fixed;	// last depth_mask, blend_func, viewport and clear_color
+	std::vector<uchar>			fixed_payload;
+
+	std::string	path;				// output of the capture in progress
+	size_t	state_size = 0;			// commands of the state section at the head of the capture
+	bool	capturing = false;
+
+	trace_device_t(render_device_t& d) : record_device_t(d) { enabled = false; }
+	const char* name() const override { return device.name(); }
+	void begin(const char* output_path);	// captures from now to the next end_frame()
+	void end_frame() override;
+
+	GLuint create_buffer(GLenum target, size_t size, const void* data, GLenum usage) override;
+	GLuint create_vertex_array(GLuint vertex_buffer, GLuint index_buffer, const vertex_attrib_t* attribs, int count, GLsizei stride) override;
+	GLuint create_texture(ivec2 size, int channels, const void* data, bool mipmap) override;
+	GLuint create_texture_levels(ivec2 size, int channels, int levels, const void* data) override;
+	GLuint create_texture_array(ivec2 size, int levels, int layers) override;
+	GLuint create_sampler(GLenum min_filter, GLenum mag_filter, GLenum wrap) override { GLuint s = record_device_t::create_sampler(min_filter, mag_filter, wrap); samplers[s] = { min_filter, mag_filter, wrap }; return s; }
+	GLuint create_program(const char* vert_source, const char* frag_source) override;
+	GLuint create_render_target(ivec2 size, bool depth, GLuint& color) override { GLuint f = record_device_t::create_render_target(size, depth, color); render_targets[f] = { size, depth, color }; unit_texture[unit] = color; framebuffer = f; return f; }
+	void destroy(resource_t type, GLuint id) override;
+	void buffer_data(GLenum target, size_t size, const void* data, GLenum usage) override;
+	void buffer_sub_data(GLenum target, size_t offset, size_t size, const void* data) override;
+	void texture_sub_image(ivec2 offset, ivec2 size, int channels, const void* data) override;
+	void texture_layer(int layer, ivec2 size, int levels, const void* data) override;
+
+	GLint uniform_location(GLuint p, const char* name) override { GLint loc = record_device_t::uniform_location(p, name); programs[p].locations[name] = loc; return loc; }
+	void uniform_matrix4(GLint loc, const mat4& m) override { record_device_t::uniform_matrix4(loc, m); keep_uniform(UNIFORM_MATRIX4, loc, &m, sizeof(m)); }
+	void uniform4(GLint loc, const vec4& v) override { record_device_t::uniform4(loc, v); keep_uniform(UNIFORM4, loc, &v, sizeof(v)); }
+	void uniform2(GLint loc, const vec2& v) override { record_device_t::uniform2(loc, v); keep_uniform(UNIFORM2, loc, &v, sizeof(v)); }
+	void uniform1i(GLint loc, int i) override { record_device_t::uniform1i(loc, i); keep_uniform(UNIFORM1I, loc, &i, sizeof(i)); }
+	void uniform_block_binding(GLuint p, const char* name, GLuint binding) override { record_device_t::uniform_block_binding(p, name, binding); programs[p].blocks[name] = binding; }
+
+	void use_program(GLuint p) override { record_device_t::use_program(program = p); }
+	void bind_vertex_array(GLuint v) override;
+	void bind_buffer(GLenum target, GLuint b) override { record_device_t::bind_buffer(target, b); bound(target) = b; }
+	void bind_buffer_base(GLenum target, GLuint index, GLuint b) override { record_device_t::bind_buffer_base(target, index, b); bound(target) = b; if (target == GL_UNIFORM_BUFFER) uniform_bindings[index] = b; }
+	void active_texture(GLuint u) override { record_device_t::active_texture(unit = u); }
+	void bind_texture(GLuint t) override { record_device_t::bind_texture(unit_texture[unit] = t); }
+	void bind_texture_array(GLuint t) override { record_device_t::bind_texture_array(unit_texture_array[unit] = t); }
+	void bind_sampler(GLuint u, GLuint s) override { record_device_t::bind_sampler(u, unit_sampler[u] = s); }
+	void bind_framebuffer(GLuint f) override { record_device_t::bind_framebuffer(framebuffer = f); }
+	void enable(GLenum cap, bool b) override { record_device_t::enable(cap, caps[cap] = b); }
+	void depth_mask(bool b) override { record_device_t::depth_mask(b); keep_fixed(DEPTH_MASK, { uint(b) }); }
+	void blend_func(GLenum src, GLenum dst) override { record_device_t::blend_func(src, dst); keep_fixed(BLEND_FUNC, { src, dst }); }
+	void pixel_store(GLenum pname, GLint value) override { record_device_t::pixel_store(pname, pixel_stores[pname] = value); }
+	void viewport(ivec2 origin, ivec2 size) override { record_device_t::viewport(origin, size); keep_fixed(VIEWPORT, { uint(origin.x), uint(origin.y), uint(size.x), uint(size.y) }); }
+	void clear_color(const vec4& c) override { record_device_t::clear_color(c); keep_fixed(CLEAR_COLOR, {}, &c, sizeof(c)); }
+
+protected:
+	GLuint& bound(GLenum target) { return target == GL_ELEMENT_ARRAY_BUFFER ? element_buffer : target == GL_UNIFORM_BUFFER ? uniform_buffer : array_buffer; }
+	void keep_uniform(uint op, GLint loc, const void* data, size_t size) { value_t& v = programs[program].uniforms[loc]; v.op = op; v.data.assign((const uchar*)data, (const uchar*)data + size); }
+	void keep_fixed(op_t op, std::initializer_list<uint> args, const void* data = nullptr, size_t size = 0);
+	void write_state();
+	void write_resources();
+	static size_t row_bytes(int width, int channels, GLint alignment) { size_t r = size_t(width) * channels, a = size_t(alignment); return (r + a - 1) / a * a; }
+};
+
+//*************************************
+inline GLuint trace_device_t::create_buffer(GLenum target, size_t size, const void* data, GLenum usage)
+{
+	GLuint b = record_device_t::create_buffer(target, size, data, usage);
+	buffer_t& s = buffers[b]; s.target = target; s.usage = usage;
+	s.data.assign(size, 0); if (data && size) memcpy(&s.data[0], data, size);
+	bound(target) = b;
+	return b;
+}
+
+inline GLuint trace_device_t::create_vertex_array(GLuint vertex_buffer, GLuint index_buffer, const vertex_attrib_t* attribs, int count, GLsizei stride)
+{
+	GLuint v = record_device_t::create_vertex_array(vertex_buffer, index_buffer, attribs, count, stride);
+	if (v) vertex_arrays[v] = { vertex_buffer, index_buffer, stride, std::vector<vertex_attrib_t>(attribs, attribs + count) };
+	array_buffer = vertex_buffer;	// left bound by the creation; the vertex array itself is not
+	return v;
+}
+
+inline GLuint trace_device_t::create_texture(ivec2 size, int channels, const void* data, bool mipmap)
+{
+	GLuint t = record_device_t::create_texture(size, channels, data, mipmap);
+	texture_t& s = textures[t]; s.size = size; s.channels = channels; s.mipmap = mipmap; s.levels = s.layers = 0;
+	s.pixels.assign(row_bytes(size.x, channels, 4) * size.y, 0); if (data) memcpy(&s.pixels[0], data, s.pixels.size());
+	unit_texture[unit] = t;
+	return t;
+}
+
+inline GLuint trace_device_t::create_texture_levels(ivec2 size, int channels, int levels, const void* data)
+{
+	GLuint t = record_device_t::create_texture_levels(size, channels, levels, data);
+	texture_t& s = textures[t]; s.size = size; s.channels = channels; s.mipmap = levels > 1; s.levels = levels; s.layers = 0;
+	s.pixels.assign((const uchar*)data, (const uchar*)data + texture_bytes(size, channels, levels));
+	unit_texture[unit] = t;
+	return t;
+}
+
+inline GLuint trace_device_t::create_texture_array(ivec2 size, int levels, int layers)
+{
+	GLuint t = record_device_t::create_texture_array(size, levels, layers);
+	texture_t& s = textures[t]; s.size = size; s.channels = 4; s.mipmap = levels > 1; s.levels = levels; s.layers = layers;
+	s.pixels.assign(texture_bytes(size, 4, levels) * layers, 0);
+	unit_texture_array[unit] = t;
+	return t;
+}
+
+inline GLuint trace_device_t::create_program(const char* vert_source, const char* frag_source)
+{
+	GLuint p = record_device_t::create_program(vert_source, frag_source);
+	if (!p) return 0;
+	program_t& s = programs[p];
+	s.vert_size = uint(strlen(vert_source) + 1);
+	s.sources = std::string(vert_source, s.vert_size) + std::string(frag_source, strlen(frag_source) + 1);
+	return p;
+}
+
+inline void trace_device_t::destroy(resource_t type, GLuint id)
+{
+	record_device_t::destroy(type, id);
+	if (type == BUFFER) buffers.erase(id);
+	else if (type == VERTEX_ARRAY) vertex_arrays.erase(id);
+	else if (type == TEXTURE) textures.erase(id);
+	else if (type == SAMPLER) samplers.erase(id);
+	else if (type == PROGRAM) programs.erase(id);
+	else if (type == FRAMEBUFFER) render_targets.erase(id);
+}
+
+inline void trace_device_t::buffer_data(GLenum target, size_t size, const void* data, GLenum usage)
+{
+	record_device_t::buffer_data(target, size, data, usage);
+	auto it = buffers.find(bound(target));
+	if (it == buffers.end()) return;
+	it->second.usage = usage;
+	it->second.data.assign(size, 0); if (data && size) memcpy(&it->second.data[0], data, size);
+}
+
+inline void trace_device_t::buffer_sub_data(GLenum target, size_t offset, size_t size, const void* data)
+{
+	record_device_t::buffer_sub_data(target, offset, size, data);
+	auto it = buffers.find(bound(target));
+	if (it == buffers.end() || offset + size > it->second.data.size()) return;
+	memcpy(&it->second.data[offset], data, size);
+}
+
+inline void trace_device_t::texture_sub_image(ivec2 offset, ivec2 size, int channels, const void* data)
+{
+	record_device_t::texture_sub_image(offset, size, channels, data);
+	auto it = textures.find(unit_texture[unit]);
+	if (it == textures.end() || it->second.channels != channels) return;
+	texture_t& t = it->second;
+	if (offset.x < 0 || offset.y < 0 || offset.x + size.x > t.size.x || offset.y + size.y > t.size.y) return;
+
+	size_t src_row = row_bytes(size.x, channels, unpack_alignment), dst_row = row_bytes(t.size.x, channels, 4);
+	for (int y = 0; y < size.y; y++) memcpy(&t.pixels[dst_row * (offset.y + y) + size_t(offset.x) * channels], (const uchar*)data + src_row * y, size_t(size.x) * channels);
+}
+
+inline void trace_device_t::texture_layer(int layer, ivec2 size, int levels, const void* data)
+{
+	record_device_t::texture_layer(layer, size, levels, data);
+	auto it = textures.find(unit_texture_array[unit]);
+	if (it == textures.end() || layer < 0 || layer >= it->second.layers || size.x != it->second.size.x || size.y != it->second.size.y || levels != it->second.levels) return;
+	size_t n = texture_bytes(size, 4, levels);
+	memcpy(&it->second.pixels[n * layer], data, n);
+}
+
+inline void trace_device_t::bind_vertex_array(GLuint v)
+{
+	record_device_t::bind_vertex_array(vertex_array = v);
+	auto it = vertex_arrays.find(v);
+	element_buffer = it == vertex_arrays.end() ? 0 : it->second.index_buffer;	// part of the vertex array state
+}
+
+inline void trace_device_t::keep_fixed(op_t op, std::initializer_list<uint> args, const void* data, size_t size)
+{
+	// one entry per operation; values of earlier calls are simply replaced
+	command_t c = { uint(op), { 0 }, 0, size };
+	uint k = 0; for (uint a : args) c.arg[k++] = a;
+	for (auto& f : fixed) if (f.op == c.op)
+	{
+		c.data = f.data;
+		if (size) memcpy(&fixed_payload[size_t(c.data)], data, size);
+		f = c; return;
+	}
+	c.data = fixed_payload.size();
+	if (size) fixed_payload.insert(fixed_payload.end(), (const uchar*)data, (const uchar*)data + size);
+	fixed.push_back(c);
+}
+
+inline void trace_device_t::write_state()
+{
+	// bound and fixed-function state at the start of the frame, after the resources
+	for (auto& p : programs)
+	{
+		if (p.second.sources.empty()) continue;
+		push(USE_PROGRAM, { p.first });
+		for (auto& l : p.second.locations) push(UNIFORM_LOCATION, { uint(l.second), p.first }, l.first.c_str(), l.first.size() + 1);
+		for (auto& u : p.second.uniforms) push(op_t(u.second.op), { uint(u.first), u.second.op == UNIFORM1I ? *(const uint*)&u.second.data[0] : 0u }, &u.second.data[0], u.second.data.size());
+		for (auto& b : p.second.blocks) push(UNIFORM_BLOCK_BINDING, { p.first, b.second }, b.first.c_str(), b.first.size() + 1);
+	}
+	for (auto& b : uniform_bindings) push(BIND_BUFFER_BASE, { GL_UNIFORM_BUFFER, b.first, b.second });
+	if (uniform_buffer) push(BIND_BUFFER, { GL_UNIFORM_BUFFER, uniform_buffer });
+	for (auto& c : caps) push(ENABLE, { c.first, uint(c.second) });
+	for (auto& s : pixel_stores) push(PIXEL_STORE, { s.first, uint(s.second) });
+	for (auto& f : fixed) push(op_t(f.op), { f.arg[0], f.arg[1], f.arg[2], f.arg[3] }, f.size ? &fixed_payload[size_t(f.data)] : nullptr, size_t(f.size));
+	for (auto& s : unit_sampler) push(BIND_SAMPLER, { s.first, s.second });
+	for (auto& t : unit_texture) { push(ACTIVE_TEXTURE, { t.first }); push(BIND_TEXTURE, { t.second }); }
+	for (auto& t : unit_texture_array) { push(ACTIVE_TEXTURE, { t.first }); push(BIND_TEXTURE_ARRAY, { t.second }); }
+	push(ACTIVE_TEXTURE, { unit });
+	push(BIND_VERTEX_ARRAY, { vertex_array });
+	push(BIND_BUFFER, { GL_ARRAY_BUFFER, array_buffer });
+	push(BIND_FRAMEBUFFER, { framebuffer });
+	push(USE_PROGRAM, { program });
+}
+
+inline void trace_device_t::write_resources()
+{
+	// only what the recorded commands refer to, with its contents at the end of the frame
+	std::set<GLuint> used[RESOURCE_NUM];
+	for (const command_t& c : commands)
+	{
+		if (c.op == USE_PROGRAM || c.op == UNIFORM_LOCATION || c.op == UNIFORM_BLOCK_BINDING) used[PROGRAM].insert(c.arg[c.op == UNIFORM_LOCATION ? 1 : 0]);
+		else if (c.op == BIND_TEXTURE || c.op == BIND_TEXTURE_ARRAY) used[TEXTURE].insert(c.arg[0]);
+		else if (c.op == BIND_SAMPLER) used[SAMPLER].insert(c.arg[1]);
+		else if (c.op == BIND_BUFFER) used[BUFFER].insert(c.arg[1]);
+		else if (c.op == BIND_BUFFER_BASE) used[BUFFER].insert(c.arg[2]);
+		else if (c.op == BIND_VERTEX_ARRAY) used[VERTEX_ARRAY].insert(c.arg[0]);
+		else if (c.op == BIND_FRAMEBUFFER) used[FRAMEBUFFER].insert(c.arg[0]);
+	}
+	for (auto& r : render_targets) if (used[TEXTURE].count(r.second.color)) used[FRAMEBUFFER].insert(r.first);	// sampled render targets
+	for (GLuint v : used[VERTEX_ARRAY]) { auto it = vertex_arrays.find(v); if (it != vertex_arrays.end()) { used[BUFFER].insert(it->second.vertex_buffer); used[BUFFER].insert(it->second.index_buffer); } }
+
+	for (auto& b : buffers) if (used[BUFFER].count(b.first)) push(CREATE_BUFFER, { b.first, b.second.target, b.second.usage, uint(b.second.data.size()) }, b.second.data.empty() ? nullptr : &b.second.data[0], b.second.data.size());
+	for (auto& t : textures) if (used[TEXTURE].count(t.first) && t.second.layers)
+	{
+		// the creation leaves the array bound for its layers
+		push(CREATE_TEXTURE_ARRAY, { t.first, uint(t.second.size.x), uint(t.second.size.y), uint(t.second.levels), uint(t.second.layers) });
+		size_t n = texture_bytes(t.second.size, 4, t.second.levels);
+		for (int l = 0; l < t.second.layers; l++) push(TEXTURE_LAYER, { uint(l), uint(t.second.size.x), uint(t.second.size.y), uint(t.second.levels) }, &t.second.pixels[n * l], n);
+	}
+	else if (used[TEXTURE].count(t.first)) push(t.second.levels ? CREATE_TEXTURE_LEVELS : CREATE_TEXTURE, { t.first, uint(t.second.size.x), uint(t.second.size.y), uint(t.second.channels), t.second.levels ? uint(t.second.levels) : uint(t.second.mipmap) }, &t.second.pixels[0], t.second.pixels.size());
+	for (auto& s : samplers) if (used[SAMPLER].count(s.first)) push(CREATE_SAMPLER, { s.first, s.second.min_filter, s.second.mag_filter, s.second.wrap });
+	for (auto& v : vertex_arrays) if (used[VERTEX_ARRAY].count(v.first)) push(CREATE_VERTEX_ARRAY, { v.first, v.second.vertex_buffer, v.second.index_buffer, uint(v.second.attribs.size()), uint(v.second.stride) }, v.second.attribs.data(), sizeof(vertex_attrib_t) * v.second.attribs.size());
+	for (auto& r : render_targets) if (used[FRAMEBUFFER].count(r.first)) push(CREATE_RENDER_TARGET, { r.first, uint(r.second.size.x), uint(r.second.size.y), uint(r.second.depth), r.second.color });
+	for (auto& p : programs) if (used[PROGRAM].count(p.first) && !p.second.sources.empty()) push(CREATE_PROGRAM, { p.first, p.second.vert_size }, p.second.sources.data(), p.second.sources.size());
+}
+
+inline void trace_device_t::begin(const char* output_path)
+{
+	if (capturing) return;
+	path = output_path;
+	clear();
+	enabled = true;
+	write_state();
+	state_size = commands.size();
+	capturing = true;
+}
+
+inline void trace_device_t::end_frame()
+{
+	device.end_frame();
+	if (!capturing) return;
+
+	// the resources go in front of the state section and the frame
+	size_t n = commands.size();
+	write_resources();
+	std::rotate(commands.begin(), commands.begin() + n, commands.end());
+
+	frame_trace_t trace;
+	trace.frame_first = uint(commands.size() - n + state_size);
+	trace.commands.swap(commands);
+	trace.payload.swap(payload);
+	if (trace.save(path.c_str())) printf("traced %zu commands (%zu in the frame), %.1f KB, to %s\n", trace.commands.size(), trace.commands.size() - trace.frame_first, trace.payload.size() / 1024.0, path.c_str());
+	clear();
+	enabled = capturing = false;
+}
+
+//*************************************
+inline bool frame_trace_t::save(const char* path) const
+{
+	FILE* fp = fopen(path, "wb"); if (!fp) { printf("%s(): unable to open %s\n", __func__, path); return false; }
+	uint header[2] = { frame_first, 0 };
+	uint64_t sizes[2] = { commands.size(), payload.size() };
+	fwrite("PSTRACE1", 1, 8, fp);
+	fwrite(header, sizeof(header), 1, fp);
+	fwrite(sizes, sizeof(sizes), 1, fp);
+	if (!commands.empty()) fwrite(&commands[0], sizeof(command_t), commands.size(), fp);
+	if (!payload.empty()) fwrite(&payload[0], 1, payload.size(), fp);
+	bool ok = !ferror(fp);
+	fclose(fp);
+	if (!ok) printf("%s(): failed to write %s\n", __func__, path);
+	return ok;
+}
+
+inline bool frame_trace_t::load(const char* path)
+{
+	FILE* fp = fopen(path, "rb"); if (!fp) { printf("%s(): unable to open %s\n", __func__, path); return false; }
+	char magic[8] = { 0 }; uint header[2]; uint64_t sizes[2];
+	bool ok = fread(magic, 1, 8, fp) == 8 && memcmp(magic, "PSTRACE1", 8) == 0 && fread(header, sizeof(header), 1, fp) == 1 && fread(sizes, sizeof(sizes), 1, fp) == 1;
+	if (ok)
+	{
+		frame_first = header[0];
+		commands.resize(size_t(sizes[0]));
+		payload.resize(size_t(sizes[1]));
+		ok = (commands.empty() || fread(&commands[0], sizeof(command_t), commands.size(), fp) == commands.size()) && (payload.empty() || fread(&payload[0], 1, payload.size(), fp) == payload.size());
+	}
+	fclose(fp);
+	if (ok && frame_first > commands.size()) ok = false;
+	for (size_t k = 0; ok && k < commands.size(); k++) ok = commands[k].op < render_device_t::OP_NUM && commands[k].data + commands[k].size <= payload.size();
+	if (!ok) printf("%s(): %s is not a valid frame trace\n", __func__, path);
+	return ok;
+}
+
+inline void frame_trace_t::replay(render_device_t& rd, int loops) const
+{
+	typedef render_device_t R;
+
+	// names and uniform locations differ between contexts; translate the recorded ones
+	std::map<GLuint, GLuint> names[R::RESOURCE_NUM];
+	std::map<std::pair<GLuint, GLint>, GLint> locations;	// (recorded program, recorded location) -> location
+	GLuint program = 0;
+	auto map = [&](int type, GLuint id) -> GLuint { auto it = names[type].find(id); return it == names[type].end() ? id : it->second; };
+	auto loc = [&](uint l) -> GLint { auto it = locations.find({ program, GLint(l) }); return it == locations.end() ? -1 : it->second; };
+
+	auto execute = [&](const command_t& c)
+	{
+		const uchar* data = c.size ? &payload[size_t(c.data)] : nullptr;
+		const uint* a = c.arg;
+		switch (c.op)
+		{
+		case R::CREATE_BUFFER:		names[R::BUFFER][a[0]] = rd.create_buffer(a[1], a[3], data, a[2]); break;
+		case R::CREATE_VERTEX_ARRAY:	names[R::VERTEX_ARRAY][a[0]] = rd.create_vertex_array(map(R::BUFFER, a[1]), map(R::BUFFER, a[2]), (const vertex_attrib_t*)data, int(a[3]), GLsizei(a[4])); break;
+		case R::CREATE_TEXTURE:		names[R::TEXTURE][a[0]] = rd.create_texture(ivec2(int(a[1]), int(a[2])), int(a[3]), data, a[4] != 0); break;
+		case R::CREATE_TEXTURE_LEVELS:	names[R::TEXTURE][a[0]] = rd.create_texture_levels(ivec2(int(a[1]), int(a[2])), int(a[3]), int(a[4]), data); break;
+		case R::CREATE_SAMPLER:		names[R::SAMPLER][a[0]] = rd.create_sampler(a[1], a[2], a[3]); break;
+		case R::CREATE_PROGRAM:		names[R::PROGRAM][a[0]] = rd.create_program((const char*)data, (const char*)data + a[1]); break;
+		case R::DESTROY:			rd.destroy(R::resource_t(a[0]), map(a[0], a[1])); break;
+		case R::BUFFER_DATA:		rd.buffer_data(a[0], a[1], data, a[2]); break;
+		case R::BUFFER_SUB_DATA:	rd.buffer_sub_data(a[0], a[1], size_t(c.size), data); break;
+		case R::TEXTURE_SUB_IMAGE:	rd.texture_sub_image(ivec2(int(a[0]), int(a[1])), ivec2(int(a[2]), int(a[3])), int(a[4]), data); break;
+		case R::UNIFORM_LOCATION:	locations[{ a[1], GLint(a[0]) }] = rd.uniform_location(map(R::PROGRAM, a[1]), (const char*)data); break;
+		case R::UNIFORM_MATRIX4:	if (loc(a[0]) > -1) rd.uniform_matrix4(loc(a[0]), *(const mat4*)data); break;
+		case R::UNIFORM4:			if (loc(a[0]) > -1) rd.uniform4(loc(a[0]), *(const vec4*)data); break;
+		case R::UNIFORM2:			if (loc(a[0]) > -1) rd.uniform2(loc(a[0]), *(const vec2*)data); break;
+		case R::UNIFORM1I:			if (loc(a[0]) > -1) rd.uniform1i(loc(a[0]), int(a[1])); break;
+		case R::USE_PROGRAM:		rd.use_program(map(R::PROGRAM, program = a[0])); break;
+		case R::BIND_VERTEX_ARRAY:	rd.bind_vertex_array(map(R::VERTEX_ARRAY, a[0])); break;
+		case R::BIND_BUFFER:		rd.bind_buffer(a[0], map(R::BUFFER, a[1])); break;
+		case R::ACTIVE_TEXTURE:		rd.active_texture(a[0]); break;
+		case R::BIND_TEXTURE:		rd.bind_texture(map(R::TEXTURE, a[0])); break;
+		case R::BIND_SAMPLER:		rd.bind_sampler(a[0], map(R::SAMPLER, a[1])); break;
+		case R::ENABLE:				rd.enable(a[0], a[1] != 0); break;
+		case R::DEPTH_MASK:			rd.depth_mask(a[0] != 0); break;
+		case R::BLEND_FUNC:			rd.blend_func(a[0], a[1]); break;
+		case R::PIXEL_STORE:		rd.pixel_store(a[0], GLint(a[1])); break;
+		case R::VIEWPORT:			rd.viewport(ivec2(int(a[0]), int(a[1])), ivec2(int(a[2]), int(a[3]))); break;
+		case R::CLEAR_COLOR:		rd.clear_color(*(const vec4*)data); break;
+		case R::CLEAR:				rd.clear(a[0]); break;
+		case R::DRAW_ELEMENTS:		rd.draw_elements(a[0], GLsizei(a[1]), a[2], a[3]); break;
+		case R::DRAW_ELEMENTS_BASE_VERTEX:	rd.draw_elements_base_vertex(a[0], GLsizei(a[1]), a[2], a[3], GLint(a[4])); break;
+		case R::DRAW_ARRAYS:		rd.draw_arrays(a[0], GLint(a[1]), GLsizei(a[2])); break;
+		case R::FINISH:				rd.finish(); break;
+		case R::CREATE_RENDER_TARGET:	{ GLuint color; names[R::FRAMEBUFFER][a[0]] = rd.create_render_target(ivec2(int(a[1]), int(a[2])), a[3] != 0, color); names[R::TEXTURE][a[4]] = color; } break;
+		case R::BIND_FRAMEBUFFER:	rd.bind_framebuffer(map(R::FRAMEBUFFER, a[0])); break;
+		case R::CREATE_TEXTURE_ARRAY:	names[R::TEXTURE][a[0]] = rd.create_texture_array(ivec2(int(a[1]), int(a[2])), int(a[3]), int(a[4])); break;
+		case R::TEXTURE_LAYER:		rd.texture_layer(int(a[0]), ivec2(int(a[1]), int(a[2])), int(a[3]), data); break;
+		case R::BIND_TEXTURE_ARRAY:	rd.bind_texture_array(map(R::TEXTURE, a[0])); break;
+		case R::BIND_BUFFER_BASE:	rd.bind_buffer_base(a[0], a[1], map(R::BUFFER, a[2])); break;
+		case R::UNIFORM_BLOCK_BINDING:	rd.uniform_block_binding(map(R::PROGRAM, a[0]), (const char*)data, a[1]); break;
+		default: break;
+		}
+	};
+
+	for (uint k = 0; k < frame_first; k++) execute(commands[k]);
+	rd.finish();
+
+	// per-call times are CPU submission times; the frame time waits for completion
+	typedef std::chrono::steady_clock clock;
+	double op_ms[R::OP_NUM] = { 0 }; uint64_t op_calls[R::OP_NUM] = { 0 };
+	double total_ms = 0, min_ms = 1e9, max_ms = 0;
+	for (int l = 0; l < loops; l++)
+	{
+		auto f0 = clock::now();
+		for (size_t k = frame_first; k < commands.size(); k++)
+		{
+			auto t0 = clock::now();
+			execute(commands[k]);
+			op_ms[commands[k].op] += std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+			op_calls[commands[k].op]++;
+		}
+		rd.finish();
+		rd.end_frame();
+		double ms = std::chrono::duration<double, std::milli>(clock::now() - f0).count();
+		total_ms += ms; min_ms = ms < min_ms ? ms : min_ms; max_ms = ms > max_ms ? ms : max_ms;
+	}
+	if (loops <= 0) return;
+
+	double calls_ms = 0; for (double t : op_ms) calls_ms += t;
+	printf("replayed %zu commands per frame %d times on %s: %.3f ms avg, %.3f min, %.3f max per frame\n", commands.size() - frame_first, loops, rd.name(), total_ms / loops, min_ms, max_ms);
+	printf("  %-20s %12s %12s %8s\n", "call", "calls/frame", "us/call", "share");
+	int order[R::OP_NUM]; for (int k = 0; k < R::OP_NUM; k++) order[k] = k;
+	std::stable_sort(order, order + R::OP_NUM, [&](int x, int y) { return op_ms[x] > op_ms[y]; });
+	for (int k : order) if (op_calls[k])
+		printf("  %-20s %12.1f %12.3f %7.1f%%\n", R::op_name(k), double(op_calls[k]) / loops, 1000.0 * op_ms[k] / op_calls[k], calls_ms > 0 ? 100.0 * op_ms[k] / calls_ms : 0.0);
+}
+
+#endif
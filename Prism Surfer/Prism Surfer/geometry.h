@@ -0,0 +1,77 @@
+#ifndef __GEOMETRY_H__
+#define __GEOMETRY_H__
+#pragma once
+
+#include "cgmath.h"
+#include "cgut.h"
+#include "render_queue.h"
+
+// static geometry arena: every built-in shape in one vertex buffer, one index buffer and
+// one vertex array, uploaded together at startup. a shape is a range of the index buffer
+// whose indices count from its own first vertex (the base vertex), so the scene keeps one
+// vertex array bound and each draw picks its range with glDrawElementsBaseVertex.
+// - add shapes before upload(); the CPU copies stay for the software rasterizer.
+struct geometry_arena_t
+{
+	struct shape_t { GLuint first; GLsizei count; GLint base_vertex; };	// first: offset into the index buffer, in indices
+
+	std::vector<vertex>		vertices;
+	std::vector<uint>		indices;
+	std::vector<shape_t>	shapes;
+	GLuint	vertex_buffer = 0, index_buffer = 0, vertex_array = 0;
+
+	uint add(const vertex* v, size_t vertex_count, const uint* i, size_t index_count);	// the new shape's id, in the order of adding
+	uint add_quad(const vec3 (&corners)[4], vec3 norm, const uint (&i)[6]);		// texture coordinates (0,0), (0,1), (1,1), (1,0) in corner order
+	bool upload();
+	void finalize();
+	void bind(draw_item_t& item, uint shape) const;	// an indexed triangle draw of the whole shape
+};
+
+inline uint geometry_arena_t::add(const vertex* v, size_t vertex_count, const uint* i, size_t index_count)
+{
+	shapes.push_back({ GLuint(indices.size()), GLsizei(index_count), GLint(vertices.size()) });
+	vertices.insert(vertices.end(), v, v + vertex_count);
+	indices.insert(indices.end(), i, i + index_count);
+	return uint(shapes.size() - 1);
+}
+
+inline uint geometry_arena_t::add_quad(const vec3 (&corners)[4], vec3 norm, const uint (&i)[6])
+{
+	static const vec2 tex[4] = { vec2(0, 0), vec2(0, 1), vec2(1, 1), vec2(1, 0) };
+	vertex v[4];
+	for (int k = 0; k < 4; k++) v[k] = { corners[k], norm, tex[k] };
+	return add(v, 4, i, 6);
+}
+
+inline bool geometry_arena_t::upload()
+{
+	render_device_t& rd = render_device_t::current();
+	vertex_buffer = rd.create_buffer(GL_ARRAY_BUFFER, sizeof(vertex) * vertices.size(), &vertices[0], GL_STATIC_DRAW);
+	index_buffer = rd.create_buffer(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint) * indices.size(), &indices[0], GL_STATIC_DRAW);
+	vertex_array = rd.create_vertex_array(vertex_buffer, index_buffer, vertex_attribs, 3, sizeof(vertex));
+	if (!vertex_array) { printf("%s(): failed to create vertex array\n", __func__); return false; }
+	return true;
+}
+
+inline void geometry_arena_t::finalize()
+{
+	render_device_t& rd = render_device_t::current();
+	if (vertex_array) rd.destroy(render_device_t::VERTEX_ARRAY, vertex_array);
+	if (index_buffer) rd.destroy(render_device_t::BUFFER, index_buffer);
+	if (vertex_buffer) rd.destroy(render_device_t::BUFFER, vertex_buffer);
+	vertex_array = index_buffer = vertex_buffer = 0;
+	vertices.clear(); indices.clear(); shapes.clear();
+}
+
+inline void geometry_arena_t::bind(draw_item_t& item, uint shape) const
+{
+	const shape_t& s = shapes[shape];
+	item.vertex_array = vertex_array;
+	item.mode = GL_TRIANGLES;
+	item.indexed = true;
+	item.first = s.first;
+	item.count = s.count;
+	item.base_vertex = s.base_vertex;
+}
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef __GLSTATE_H__
+#define __GLSTATE_H__
+#pragma once
+
+#include "cgut.h"
+#include "render_device.h"
+
+// thin shadow-state wrapper over the GL state calls issued per frame:
+// a call that would not change the current state is dropped and counted as elided.
+// the calls that survive go to the current render device.
+// - calls made around the cache (e.g., resource creation) desync it; call invalidate() afterwards.
+// - GL_ELEMENT_ARRAY_BUFFER is part of the vertex array state, so it is not cached.
+struct gl_state_t
+{
+	static constexpr GLuint UNKNOWN = ~0u;
+	static constexpr int MAX_UNITS = 4;
+	enum counter_t { ISSUED, ELIDED, DRAWS, UNIFORMS, TEXTURE_BINDS, COUNTER_NUM };	// TEXTURE_BINDS: issued ones
+	enum cap_t { BLEND, DEPTH_TEST, CULL_FACE, CAP_NUM };
+
+	GLuint	program, vertex_array, array_buffer, active_unit, framebuffer;
+	GLuint	texture[MAX_UNITS], texture_array[MAX_UNITS], sampler[MAX_UNITS];
+	int		cap[CAP_NUM], depth_mask;		// -1 if unknown
+	GLenum	blend_src, blend_dst;
+	GLint	unpack_alignment;
+	ivec2	viewport_size;					// the origin is always (0,0)
+
+	uint	counter[COUNTER_NUM] = { 0 };	// current frame
+	uint	last[COUNTER_NUM] = { 0 };		// previous frame
+	uint64_t total[COUNTER_NUM] = { 0 };	// since reset_totals()
+	uint	frames = 0;
+
+	static gl_state_t& instance() { static gl_state_t s; return s; }
+	gl_state_t() { invalidate(); }
+
+	void invalidate();
+	void end_frame() { for (int k = 0; k < COUNTER_NUM; k++) { last[k] = counter[k]; total[k] += counter[k]; counter[k] = 0; } frames++; }
+	void reset_totals() { for (auto& t : total) t = 0; frames = 0; }
+
+	void use_program(GLuint p) { if (!elide(program == p)) device().use_program(program = p); }
+	void bind_vertex_array(GLuint v) { if (!elide(vertex_array == v)) device().bind_vertex_array(vertex_array = v); }
+	void bind_array_buffer(GLuint b) { if (!elide(array_buffer == b)) device().bind_buffer(GL_ARRAY_BUFFER, array_buffer = b); }
+	void active_texture(GLuint unit) { if (!elide(active_unit == unit)) device().active_texture(active_unit = unit); }
+	void bind_texture(GLuint t, GLuint unit = 0) { if (elide(texture[unit] == t)) return; active_texture(unit); counter[TEXTURE_BINDS]++; device().bind_texture(texture[unit] = t); }
+	void bind_texture_array(GLuint t, GLuint unit = 0) { if (elide(texture_array[unit] == t)) return; active_texture(unit); counter[TEXTURE_BINDS]++; device().bind_texture_array(texture_array[unit] = t); }
+	void bind_sampler(GLuint s, GLuint unit = 0) { if (!elide(sampler[unit] == s)) device().bind_sampler(unit, sampler[unit] = s); }
+	void bind_framebuffer(GLuint f) { if (!elide(framebuffer == f)) device().bind_framebuffer(framebuffer = f); }
+	void enable(cap_t c, bool b);
+	void set_depth_mask(bool b) { if (!elide(depth_mask == int(b))) device().depth_mask((depth_mask = int(b)) != 0); }
+	void blend_func(GLenum src, GLenum dst) { if (!elide(blend_src == src && blend_dst == dst)) device().blend_func(blend_src = src, blend_dst = dst); }
+	void pixel_unpack_alignment(GLint a) { if (!elide(unpack_alignment == a)) device().pixel_store(GL_UNPACK_ALIGNMENT, unpack_alignment = a); }
+	void viewport(ivec2 size) { if (!elide(viewport_size.x == size.x && viewport_size.y == size.y)) device().viewport(ivec2(0, 0), viewport_size = size); }
+
+	// uniforms of the program in use; not cached, only counted
+	void uniform_matrix4(GLint loc, const mat4& m) { counter[UNIFORMS]++; device().uniform_matrix4(loc, m); }
+	void uniform4(GLint loc, const vec4& v) { counter[UNIFORMS]++; device().uniform4(loc, v); }
+	void uniform2(GLint loc, const vec2& v) { counter[UNIFORMS]++; device().uniform2(loc, v); }
+	void uniform1i(GLint loc, int i) { counter[UNIFORMS]++; device().uniform1i(loc, i); }
+
+	void draw_elements(GLenum mode, GLsizei count, GLenum type, size_t offset) { counter[DRAWS]++; device().draw_elements(mode, count, type, offset); }
+	void draw_elements_base_vertex(GLenum mode, GLsizei count, GLenum type, size_t offset, GLint base_vertex) { counter[DRAWS]++; device().draw_elements_base_vertex(mode, count, type, offset, base_vertex); }
+	void draw_arrays(GLenum mode, GLint first, GLsizei count) { counter[DRAWS]++; device().draw_arrays(mode, first, count); }
+
+protected:
+	static render_device_t& device() { return render_device_t::current(); }
+	bool elide(bool same) { counter[same ? ELIDED : ISSUED]++; return same; }
+};
+
+inline void gl_state_t::invalidate()
+{
+	program = vertex_array = array_buffer = active_unit = framebuffer = UNKNOWN;
+	for (int k = 0; k < MAX_UNITS; k++) texture[k] = texture_array[k] = sampler[k] = UNKNOWN;
+	for (auto& c : cap) c = -1;
+	depth_mask = -1;
+	blend_src = blend_dst = UNKNOWN;
+	unpack_alignment = -1;
+	viewport_size = ivec2(-1, -1);
+}
+
+inline void gl_state_t::enable(cap_t c, bool b)
+{
+	static const GLenum cap_enum[CAP_NUM] = { GL_BLEND, GL_DEPTH_TEST, GL_CULL_FACE };
+	if (elide(cap[c] == int(b))) return;
+	device().enable(cap_enum[c], (cap[c] = int(b)) != 0);
+}
+
+#endif
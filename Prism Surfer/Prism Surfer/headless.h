@@ -0,0 +1,142 @@
+#ifndef __HEADLESS_H__
+#define __HEADLESS_H__
+#pragma once
+
+#include "cgmath.h"
+#include "cgut.h"
+#include "render_device.h"
+
+// assume stb_image_write.h included before this header
+
+// headless rendering without a window system: an EGL context on a surfaceless
+// display (e.g., Mesa llvmpipe) renders into an offscreen framebuffer object,
+// whose contents can be read back and written as images.
+// - build with PRISM_HEADLESS defined and link against libEGL (as CMakeLists.txt does); otherwise init() fails.
+// - without a GL context (a CPU-only render device), only the clock and the size are set up.
+// - the clock is virtual and advanced by the driver, so runs are reproducible.
+#ifdef PRISM_HEADLESS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+struct headless_t
+{
+	bool	active = false;
+	double	clock = 0.0;			// virtual time in seconds
+	ivec2	size;
+	std::string	out_dir = ".";
+	GLuint	fbo = 0, color = 0, depth = 0;
+	std::vector<uchar>	pixels;		// RGB read-back scratch
+#ifdef PRISM_HEADLESS
+	EGLDisplay	display = EGL_NO_DISPLAY;
+	EGLContext	context = EGL_NO_CONTEXT;
+#endif
+
+	bool init(ivec2 frame_size, bool gl_context = true);
+	void finalize();
+	bool readable() const { return fbo != 0; }
+	bool write(const char* name);	// writes <out_dir>/<name>.png
+	static GLADloadproc proc_address();	// GL entry points of the context; nullptr without EGL
+
+protected:
+	bool create_context();
+};
+
+inline GLADloadproc headless_t::proc_address()
+{
+#ifdef PRISM_HEADLESS
+	return (GLADloadproc)eglGetProcAddress;
+#else
+	return nullptr;
+#endif
+}
+
+inline bool headless_t::init(ivec2 frame_size, bool gl_context)
+{
+	size = frame_size;
+	if (gl_context && !create_context()) return false;
+	return active = true;
+}
+
+#ifdef PRISM_HEADLESS
+inline bool headless_t::create_context()
+{
+	// prefer the surfaceless platform; fall back to the default display
+	auto get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (get_platform_display) display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+	if (display == EGL_NO_DISPLAY) display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr)) { printf("%s(): no EGL display\n", __func__); return false; }
+
+	EGLint config_attribs[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+	EGLConfig config; EGLint n = 0;
+	if (!eglChooseConfig(display, config_attribs, &config, 1, &n) || !n) { printf("%s(): no EGL config for OpenGL\n", __func__); return false; }
+
+	gl_version_t& v = gl_version_t::instance();
+	EGLint context_attribs[] = { EGL_CONTEXT_MAJOR_VERSION, gl_version_t::major_default, EGL_CONTEXT_MINOR_VERSION, gl_version_t::minor_default,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE };
+	eglBindAPI(EGL_OPENGL_API);
+	if ((context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs)) == EGL_NO_CONTEXT) { printf("%s(): failed to create a GL %d.%d context\n", __func__, int(gl_version_t::major_default), int(gl_version_t::minor_default)); return false; }
+	if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) { printf("%s(): eglMakeCurrent() failed\n", __func__); return false; }
+
+	// the same loader and version bookkeeping as cg_init_extensions()
+	if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress)) { printf("%s(): Failed in gladLoadGLLoader()\n", __func__); return false; }
+	printf("Using %s on %s, %s (headless)\n", glGetString(GL_VERSION), glGetString(GL_RENDERER), glGetString(GL_VENDOR));
+	glGetIntegerv(GL_MAJOR_VERSION, &v.major);
+	glGetIntegerv(GL_MINOR_VERSION, &v.minor); while (v.minor > 10) v.minor /= 10;
+	const char* strGLSLver = (const char*)glGetString(GL_SHADING_LANGUAGE_VERSION);
+	if (strGLSLver) { sscanf(strGLSLver, "%d.%d", &v.sl.major, &v.sl.minor); while (v.sl.minor >= 10) v.sl.minor /= 10; }
+
+	// offscreen target; the device binds it for framebuffer 0
+	glGenRenderbuffers(1, &color);
+	glBindRenderbuffer(GL_RENDERBUFFER, color);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, size.x, size.y);
+	glGenRenderbuffers(1, &depth);
+	glBindRenderbuffer(GL_RENDERBUFFER, depth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size.x, size.y);
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) { printf("%s(): incomplete framebuffer\n", __func__); return false; }
+	gl_device_t::instance().default_framebuffer = fbo;
+	glViewport(0, 0, size.x, size.y);
+
+	pixels.resize(size_t(size.x) * size.y * 3);
+	return true;
+}
+
+inline void headless_t::finalize()
+{
+	if (fbo) glDeleteFramebuffers(1, &fbo);
+	if (color) glDeleteRenderbuffers(1, &color);
+	if (depth) glDeleteRenderbuffers(1, &depth);
+	if (display != EGL_NO_DISPLAY)
+	{
+		eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		if (context != EGL_NO_CONTEXT) eglDestroyContext(display, context);
+		eglTerminate(display);
+	}
+	active = false;
+}
+#else
+inline bool headless_t::create_context() { printf("%s(): built without PRISM_HEADLESS\n", __func__); return false; }
+inline void headless_t::finalize() {}
+#endif
+
+inline bool headless_t::write(const char* name)
+{
+	if (!readable()) { printf("%s(): no GL context to read %s from\n", __func__, name); return false; }
+
+	// RGB only: blending leaves partial alpha in the target
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, size.x, size.y, GL_RGB, GL_UNSIGNED_BYTE, &pixels[0]);
+
+	// GL rows are bottom-up: start from the last row with a negative stride
+	// (not stbi_flip_vertically_on_write(), which is global and shared with the frame recorder)
+	std::string path = out_dir + "/" + name + ".png";
+	int stride = size.x * 3;
+	if (!stbi_write_png(path.c_str(), size.x, size.y, 3, &pixels[0] + size_t(stride) * (size.y - 1), -stride)) { printf("%s(): failed to write %s\n", __func__, path.c_str()); return false; }
+	return true;
+}
+
+#endif
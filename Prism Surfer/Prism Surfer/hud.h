@@ -0,0 +1,178 @@
+#ifndef __HUD_H__
+#define __HUD_H__
+#pragma once
+
+#include "cgmath.h"
+#include "cgut.h"
+#include "sprite.h"
+
+// assume stb_truetype.h included before this header
+// - its implementation section is not guarded against a second inclusion
+
+// retained HUD layer: every widget owns one glyph row of a shared texture,
+// and the quads of all visible widgets are cached and submitted as one
+// sprite run, which the batcher draws with a single call.
+// text is re-rasterized only for dirty widgets, and the quads are rebuilt
+// only when a visible width, the visibility or the window size changes.
+struct hud_widget_t
+{
+	enum align_t { LEFT, CENTER };
+
+	const char*	format = "%d";		// printf-style format for integer widgets
+	char	text[64] = { 0 };		// text currently rasterized in the glyph row
+	int		value = INT_MIN;		// last integer value given to set_int()
+	vec2	anchor;					// placement in window-relative units [0,1]
+	int		align = LEFT;
+	float	scale = 1.0f;			// text height relative to hud_t::TEXT_H
+	int		pixel_width = 0;		// width of the rasterized text in texels
+	bool	visible = false;
+	bool	dirty = true;
+};
+
+struct hud_t
+{
+	enum { SCORE, BEST, MODE, FPS, RESULT, PERF_FRAME, PERF_CALLS, PERF_SCENE, WIDGET_NUM };	// PERF_*: lines of the performance overlay
+	static constexpr int ROW_W = 1024;		// glyph row size in texels; wide enough for the overlay's lines
+	static constexpr int ROW_H = 68;
+	static constexpr int GLYPH_H = 64;		// font pixel height within a row
+	static constexpr float TEXT_H = 0.0871f;	// glyph height relative to the window height
+
+	hud_widget_t	widget[WIDGET_NUM];
+	const stbtt_fontinfo* font = nullptr;
+	std::vector<uchar>	pixels;		// CPU copy of the glyph rows
+	uint	version = 0;			// bumped whenever a row is re-rasterized
+	GLuint	texture = 0;
+	GLuint	sampler = 0;				// linear, clamped to the glyph rows
+	sprite_vertex	quads[4 * WIDGET_NUM];	// cached layout of visible widgets
+	uint	quad_count = 0;
+	ivec2	layout_size;			// window size of the current layout
+	bool	layout_dirty = true;
+
+	bool init(const stbtt_fontinfo* f, GLuint s);
+	void finalize();
+	void set_text(int id, const char* s);
+	void set_int(int id, int v);
+	void set_visible(int id, bool b) { if (widget[id].visible != b) { widget[id].visible = b; layout_dirty = true; } }
+	void set_anchor(int id, vec2 a, int align = hud_widget_t::LEFT) { widget[id].anchor = a; widget[id].align = align; layout_dirty = true; }
+	void set_scale(int id, float s) { widget[id].scale = s; layout_dirty = true; }
+	void update(ivec2 window_size);
+	void draw(sprite_batch_t& batch) const { batch.add(sprite_batch_t::OVERLAY, texture, sampler, quads, quad_count); }
+
+protected:
+	void rasterize(int id);
+	void layout(ivec2 window_size);
+};
+
+inline bool hud_t::init(const stbtt_fontinfo* f, GLuint s)
+{
+	font = f;
+	sampler = s;
+	pixels.assign(ROW_W * ROW_H * WIDGET_NUM, 0);
+
+	widget[SCORE].format = "Score: %d";		widget[SCORE].anchor = vec2(0.76f, 0.017f);
+	widget[BEST].format = "Best: %d";		widget[BEST].anchor = vec2(0.76f, 0.017f + TEXT_H);
+	widget[MODE].anchor = vec2(0.02f, 0.017f);
+	widget[FPS].format = "FPS: %d";			widget[FPS].anchor = vec2(0.02f, 0.017f + TEXT_H);
+	widget[RESULT].format = " Your Score: %d";	widget[RESULT].anchor = vec2(0.5f, 0.4517f);	widget[RESULT].align = hud_widget_t::CENTER;
+
+	// one glyph row per widget; coverage goes to alpha, color stays white
+	texture = render_device_t::current().create_texture(ivec2(ROW_W, ROW_H * WIDGET_NUM), 1, &pixels[0], false);
+
+	return true;
+}
+
+inline void hud_t::finalize()
+{
+	render_device_t::current().destroy(render_device_t::TEXTURE, texture);
+}
+
+inline void hud_t::set_text(int id, const char* s)
+{
+	hud_widget_t& w = widget[id];
+	if (strcmp(w.text, s) == 0) return;
+	snprintf(w.text, sizeof(w.text), "%s", s);
+	w.dirty = true;
+}
+
+inline void hud_t::set_int(int id, int v)
+{
+	hud_widget_t& w = widget[id];
+	if (w.value == v) return;
+	w.value = v;
+	snprintf(w.text, sizeof(w.text), w.format, v);
+	w.dirty = true;
+}
+
+inline void hud_t::rasterize(int id)
+{
+	hud_widget_t& w = widget[id];
+	uchar* bitmap = &pixels[size_t(id) * ROW_W * ROW_H];
+	memset(bitmap, 0, ROW_W * ROW_H);
+
+	float scale = stbtt_ScaleForPixelHeight(font, float(GLYPH_H));
+	int ascent, descent, linegap;
+	stbtt_GetFontVMetrics(font, &ascent, &descent, &linegap);
+	ascent = int(ascent * scale);
+
+	int x = 0, top = (ROW_H - GLYPH_H) / 2;
+	for (const char* c = w.text; *c; c++)
+	{
+		int ax, lsb, c_x1, c_y1, c_x2, c_y2;
+		stbtt_GetCodepointHMetrics(font, *c, &ax, &lsb);
+		stbtt_GetCodepointBitmapBox(font, *c, scale, scale, &c_x1, &c_y1, &c_x2, &c_y2);
+
+		// stop at the row boundary instead of writing into the next row
+		int gx = x + int(lsb * scale), gy = top + ascent + c_y1;
+		if (gx < 0 || gx + (c_x2 - c_x1) > ROW_W || gy < 0 || gy + (c_y2 - c_y1) > ROW_H) break;
+		stbtt_MakeCodepointBitmap(font, bitmap + gx + gy * ROW_W, c_x2 - c_x1, c_y2 - c_y1, ROW_W, scale, scale, *c);
+
+		x += int(ax * scale);
+		if (c[1]) x += int(stbtt_GetCodepointKernAdvance(font, c[0], c[1]) * scale);
+	}
+
+	int width = min(x, ROW_W);
+	if (width != w.pixel_width) { w.pixel_width = width; layout_dirty = true; }
+
+	gl_state_t& gs = gl_state_t::instance();
+	gs.bind_texture(texture);
+	gs.pixel_unpack_alignment(1);
+	render_device_t::current().texture_sub_image(ivec2(0, id * ROW_H), ivec2(ROW_W, ROW_H), 1, bitmap);
+	gs.pixel_unpack_alignment(4);
+	w.dirty = false;
+	version++;
+}
+
+inline void hud_t::layout(ivec2 window_size)
+{
+	// quads in window pixels (x right, y down); texcoord v=0 at the top of a glyph row
+	uint n = 0;
+	float s = TEXT_H * window_size.y / GLYPH_H;		// window pixels per texel
+	for (int k = 0; k < WIDGET_NUM; k++)
+	{
+		const hud_widget_t& w = widget[k];
+		if (!w.visible || !w.pixel_width) continue;
+
+		float qw = w.pixel_width * s * w.scale, qh = ROW_H * s * w.scale;
+		float x0 = w.anchor.x * window_size.x - (w.align == hud_widget_t::CENTER ? qw / 2 : 0), y0 = w.anchor.y * window_size.y;
+		float u1 = w.pixel_width / float(ROW_W), v0 = k / float(WIDGET_NUM), v1 = (k + 1) / float(WIDGET_NUM);
+
+		sprite_vertex* v = quads + n * 4;
+		v[0] = { vec2(x0, y0), vec2(0, v0), vec4(1.0f) };
+		v[1] = { vec2(x0, y0 + qh), vec2(0, v1), vec4(1.0f) };
+		v[2] = { vec2(x0 + qw, y0 + qh), vec2(u1, v1), vec4(1.0f) };
+		v[3] = { vec2(x0 + qw, y0), vec2(u1, v0), vec4(1.0f) };
+		n++;
+	}
+
+	quad_count = n;
+	layout_size = window_size;
+	layout_dirty = false;
+}
+
+inline void hud_t::update(ivec2 window_size)
+{
+	for (int k = 0; k < WIDGET_NUM; k++) if (widget[k].visible && widget[k].dirty) rasterize(k);
+	if (layout_dirty || layout_size.x != window_size.x || layout_size.y != window_size.y) layout(window_size);
+}
+
+#endif
@@ -1,3 +1,4 @@
+#include "std_prelude.h"	// ahead of cgmath.h's min/max macros
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #define STB_TRUETYPE_IMPLEMENTATION
@@ -7,7 +8,27 @@
 #include "cgmath.h"		// slee's simple math library
 #include "cgut.h"		// slee's OpenGL utility
 #include "shaders.h"
+#include "shader_variants.h"
+#include "camera_block.h"
+#include "geometry.h"
 #include "particle.h"
+#include "sprite.h"
+#include "hud.h"
+#include "render_queue.h"
+#include "glstate.h"
+#include "render_device.h"
+#include "headless.h"
+#include "capture.h"
+#include "softras.h"
+#include "frame_trace.h"
+#include "frame_graph.h"
+#include "dynamic_resolution.h"
+#include "frame_pacer.h"
+#include "pass_timer.h"
+#include "perf_overlay.h"
+#include "profiler.h"
+#include "texture_cooker.h"
+#include "asset_loader.h"
 #include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -33,6 +54,9 @@ static const uint	texture_num = 8;
 static const char* texture_path[texture_num] = { "textures/background.jpg", "textures/tiles.png", "textures/obstacle.png",
 											"textures/player.png", "textures/title.jpg", "textures/gameover.jpg", "textures/howto.jpg", "textures/particle.png" };
 static const bool	texture_alpha[texture_num] = { false, true, true, true, false, false, false, true};
+static const int	texture_layer[texture_num] = { -1, 0, 1, 2, -1, -1, -1, 3 };	// layer in scene_textures, -1: a texture of its own
+static const ivec2	scene_layer_size = ivec2(309, 308);	// the tiles' size; the smaller scene textures are resampled to it when cooked
+static const vec4	clear_color = vec4(39 / 255.0f, 40 / 255.0f, 34 / 255.0f, 1.0f);
 
 const uint	NUM_RECT = 6;
 const float radius = 5.0f;
@@ -44,7 +68,19 @@ const float backheight = backwidth / 1440 * 960;
 
 const uint dist_view = 18;
 
-const string scorehead = "Score: ";
+// rotation of wall i about the prism's axis (z) by PI * i / 3, as compile-time cosines and sines
+static constexpr float	wall_cos[NUM_RECT] = { 1.0f, 0.5f, -0.5f, -1.0f, -0.5f, 0.5f };
+static constexpr float	wall_sin[NUM_RECT] = { 0.0f, 0.866025404f, 0.866025404f, 0.0f, -0.866025404f, -0.866025404f };
+
+// translate(offset) * rotate(vec3(0,0,1), PI * i / 3) * scale(s), composed directly from the tables
+inline mat4 wall_transform(int i, const vec3& offset, const vec3& s = vec3(1.0f))
+{
+	float c = wall_cos[i], n = wall_sin[i];
+	return mat4(c * s.x, -n * s.y, 0, offset.x, n * s.x, c * s.y, 0, offset.y, 0, 0, s.z, offset.z, 0, 0, 0, 1);
+}
+
+// a point in the frame of wall i (x across, y toward the wall), rotated into the prism's
+inline vec3 wall_point(int i, float x, float y) { return vec3(wall_cos[i] * x - wall_sin[i] * y, wall_sin[i] * x + wall_cos[i] * y, 0); }
 
 //*************************************
 // common structures
@@ -56,7 +92,7 @@ struct camera
 	mat4	view_matrix = mat4::look_at(eye, at, up);
 
 	float	fovy = PI / 4.0f; // must be in radian
-	float	aspect;
+	float	aspect = 0;
 	float	dnear = 1.0f;
 	float	dfar = 1000.0f;
 	mat4	projection_matrix;
@@ -76,13 +112,19 @@ ivec2		back_window_size, back_window_pos;
 
 //*************************************
 // OpenGL objects
-GLuint	program = 0;	// ID holder for GPU program
+shader_variants_t	scene_shaders;	// specializations of vert_shader and frag_shader
+camera_block_t	camera_block;	// view and projection of the scene programs
 GLuint  texture[texture_num];		// bg, tile, obstacle, player, title, gameover, help
+GLuint	scene_textures = 0;		// tiles, obstacle, player and particle as one array, bound once for the whole scene
 GLuint	ttexture;
+GLuint	mip_sampler = 0;		// scene textures and backdrops
+GLuint	linear_sampler = 0;		// particles
+GLuint	clamp_sampler = 0;		// HUD glyph rows
 
 //*************************************
 // stb_font objects
 stbtt_fontinfo finfo;
+std::vector<uchar>	font_data;	// finfo points into it, unless the font is a view into the pack
 
 //*************************************
 // global variables
@@ -93,9 +135,14 @@ int		pan_trigger = 0;
 int state_right = 0;
 int state_left = 0;
 int state_game = 0;
-int pause=0;
+int paused=0;
 int help = 0;
 int full = 0;
+bool redraw = true;		// static screens (menus, pause, game over) repaint only when set
+
+int best_score = 0;
+int fps_frames = 0;
+float fps_time;
 
 float pause_time;
 float start_time;
@@ -107,490 +154,274 @@ vector<particle_t> particles;
 
 //*************************************
 // scene objects
-mesh* mMesh = nullptr, * oMesh = nullptr, * pMesh = nullptr, * bMesh = nullptr, * tMesh = nullptr;
-uint part = 0;
+geometry_arena_t	geometry;	// every shape below, behind one vertex array
+enum shape_t { SHAPE_TILE, SHAPE_OBSTACLE, SHAPE_PLAYER, SHAPE_PARTICLE, SHAPE_NUM };
 camera		cam;
+hud_t		hud;
+sprite_batch_t	sprites;
+render_queue_t	queue;
+headless_t	headless;
+frame_capture_t	recorder;
+soft_rasterizer_t	softras;
+bool		use_soft = false;	// headless frames from the software rasterizer instead of GL
+null_device_t	null_device;	// CPU-only render devices for headless runs without a context
+record_device_t	record_device(null_device);
+trace_device_t*	tracer = nullptr;	// installed in front of the device with --trace
+std::string	trace_dir;
+std::string	profile_path = "profile.json";	// F11 writes the last profile_seconds of zones here; with --profile, so does the exit
+const double	profile_seconds = 10;
+frame_graph_t	graph;			// passes of render(); see register_passes()
+int		scene_target = 0;		// backdrop and scene; stays on the backbuffer unless a pass samples it
+resolution_scaler_t	dynres;		// the scene_target's scale of the window size
+frame_pacer_t	pacer;			// gameplay frames at 60 Hz on a window
+pass_timer_t	pass_timer;		// GPU and CPU time of the passes, with --pass-times or the overlay
+perf_overlay_t	overlay;		// frame times and counters on screen; F3 or --overlay
+asset_loader_t	loader;			// textures and the font stream in after user_init()
+asset_pack_t	pack;			// assets.pack, when there is one
+int		title_asset = -1;		// the first screen waits only for this one
+std::chrono::steady_clock::time_point	launch_time = std::chrono::steady_clock::now();
+
+// game clock: GLFW time, or the virtual clock of a headless run
+inline float now() { return headless.active ? float(headless.clock) : float(glfwGetTime()); }
+inline double ms_since(std::chrono::steady_clock::time_point t) { return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t).count(); }
 
 //*************************************
 
-mesh* create_rectangle_mesh(float width, float height)
+bool create_shapes()
 {
-	mesh* msh = new mesh();
-
-	// TODO: Creating vertex buffer and index buffer of a rectangle
-	vector<vertex> vlist;
-	vector<uint> ilist = { 0,2,1,2,0,3 };
-	vertex v;
-	v.pos = vec3(-width / 2, radius, 0);				//left two vertex
-	v.norm = vec3(0, -1, 0);
-	v.tex = vec2(.0f, .0f);
-
-	vlist.push_back(v);
-
-	v.pos = vec3(-width / 2, radius, height);
-	v.tex = vec2(.0f, 1.0f);
-	vlist.push_back(v);
-
-	v.pos = vec3(width / 2, radius, height);			//right two vertex
-	//v.norm = vec3(-sinf(PI / 6), -cosf(PI / 6), 0);
-	v.tex = vec2(1.0f, 1.0f);
-	vlist.push_back(v);
-
-	v.pos = vec3(width / 2, radius, 0);
-	v.tex = vec2(1.0f, .0f);
-	vlist.push_back(v);
-	
-	msh->vertex_list.resize(vlist.size());
-	msh->index_list.resize(ilist.size());
-	copy(vlist.begin(), vlist.end(), msh->vertex_list.begin());
-	copy(ilist.begin(), ilist.end(), msh->index_list.begin());
-
-	glGenBuffers(1, &msh->vertex_buffer);
-	glBindBuffer(GL_ARRAY_BUFFER, msh->vertex_buffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertex) * msh->vertex_list.size(), &msh->vertex_list[0], GL_STATIC_DRAW);
-
-	glGenBuffers(1, &msh->index_buffer);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, msh->index_buffer);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint) * msh->index_list.size(), &msh->index_list[0], GL_STATIC_DRAW);
-
-	msh->vertex_array = cg_create_vertex_array(msh->vertex_buffer, msh->index_buffer);
-	if(!msh->vertex_array) { printf("%s(): failed to create vertex aray\n", __func__); return nullptr; }
-
-	return msh;
+	// added in the order of shape_t; corners go with texture coordinates (0,0), (0,1), (1,1), (1,0)
+	float w = width / 2, ow = width * (radius - radius / 2) / (2 * radius), pw = width / 10, ph = width / 5;
+	geometry.add_quad({ vec3(-w, radius, 0), vec3(-w, radius, height), vec3(w, radius, height), vec3(w, radius, 0) }, vec3(0, -1, 0), { 0,2,1,2,0,3 });	// a wall tile, inside the prism
+	geometry.add_quad({ vec3(-w, radius, 0), vec3(w, radius, 0), vec3(ow, radius / 2, 0), vec3(-ow, radius / 2, 0) }, vec3(0, 0, -1), { 0,1,2,2,3,0 });	// an obstacle, from the wall halfway in
+	geometry.add_quad({ vec3(-pw, 0, 0), vec3(-pw, -ph, 0), vec3(pw, -ph, 0), vec3(pw, 0, 0) }, vec3(0, -1, 0), { 0,2,1,2,0,3 });	// the player, hanging from its base
+	geometry.add_quad({ vec3(-1, -1, 0), vec3(-1, 1, 0), vec3(1, 1, 0), vec3(1, -1, 0) }, vec3(0, 0, 1), { 0,3,1,1,3,2 });	// a unit particle
+	return geometry.upload();
 }
 
-mesh* create_obstacle_mesh(float width, float height)
+void update()
 {
-	mesh* msh = new mesh();
-
-	// TODO: Creating vertex buffer and index buffer of a rectangle
-	vector<vertex> vlist;
-	vector<uint> ilist = { 0,1,2,2,3,0 };
-	vertex v;
-
-	v.pos = vec3(-width / 2, radius, 0);				//up two vertex
-	v.norm = vec3(0, 0, -1);
-	v.tex = vec2(.0f, .0f);
-
-	vlist.push_back(v);
-
-	v.pos = vec3(width / 2, radius, 0);
-	v.tex = vec2(.0f, 1.0f);
-	vlist.push_back(v);
+	PROFILE_ZONE("update");
+	// update projection matrix when the aspect ratio changes
+	float aspect = window_size.x / float(window_size.y);
+	if (aspect != cam.aspect) cam.projection_matrix = mat4::perspective(cam.fovy, cam.aspect = aspect, cam.dnear, cam.dfar);
 
-	v.pos = vec3(width * (radius - height) / (2 * radius), radius - height, 0);			//down two vertex
-	v.tex = vec2(1.0f, 1.0f);
-	vlist.push_back(v);
-
-	v.pos = vec3(-width * (radius - height) / (2 * radius), radius - height, 0);
-	v.tex = vec2(1.0f, .0f);
-	vlist.push_back(v);
-
-	msh->vertex_list.resize(vlist.size());
-	msh->index_list.resize(ilist.size());
-	copy(vlist.begin(), vlist.end(), msh->vertex_list.begin());
-	copy(ilist.begin(), ilist.end(), msh->index_list.begin());
-
-	glGenBuffers(1, &msh->vertex_buffer);
-	glBindBuffer(GL_ARRAY_BUFFER, msh->vertex_buffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertex) * msh->vertex_list.size(), &msh->vertex_list[0], GL_STATIC_DRAW);
-
-	glGenBuffers(1, &msh->index_buffer);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, msh->index_buffer);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint) * msh->index_list.size(), &msh->index_list[0], GL_STATIC_DRAW);
+	// build the model matrix for oscillating scale
+	float t = now();
+	//float scale	= 1.0f+float(cos(t*1.5f))*0.05f;
+	//mat4 model_matrix = mat4::scale( scale, scale, scale );
 
-	msh->vertex_array = cg_create_vertex_array(msh->vertex_buffer, msh->index_buffer);
-	if (!msh->vertex_array) { printf("%s(): failed to create vertex aray\n", __func__); return nullptr; }
+	if (!paused) for (auto& p : particles) { PROFILE_ZONE("particle"); p.update(); }	// repaints while paused must not animate
 
-	return msh;
+	// the camera block is shared by the scene programs; uploaded only when the camera moved
+	camera_block.update(cam.view_matrix, cam.projection_matrix);
 }
 
-mesh* create_player_mesh(float width, float height)
+void add_backdrop(GLuint tex)
 {
-	mesh* msh = new mesh();
-
-	// TODO: Creating vertex buffer and index buffer of a rectangle
-	vector<vertex> vlist;
-	vector<uint> ilist = { 0,2,1,2,0,3 };
-	vertex v;
-	v.pos = vec3(-width / 2, 0, 0);				//left two vertex
-	v.norm = vec3(0, -1, 0);
-	v.tex = vec2(.0f, .0f);
-
-	vlist.push_back(v);
-
-	v.pos = vec3(-width / 2, -height, 0);
-	v.tex = vec2(.0f, 1.0f);
-	vlist.push_back(v);
-
-	v.pos = vec3(width / 2, -height, 0);			//right two vertex
-	//v.norm = vec3(-sinf(PI / 6), -cosf(PI / 6), 0);
-	v.tex = vec2(1.0f, 1.0f);
-	vlist.push_back(v);
-
-	v.pos = vec3(width / 2, 0, 0);
-	v.tex = vec2(1.0f, .0f);
-	vlist.push_back(v);
-
-	msh->vertex_list.resize(vlist.size());
-	msh->index_list.resize(ilist.size());
-	copy(vlist.begin(), vlist.end(), msh->vertex_list.begin());
-	copy(ilist.begin(), ilist.end(), msh->index_list.begin());
-
-	glGenBuffers(1, &msh->vertex_buffer);
-	glBindBuffer(GL_ARRAY_BUFFER, msh->vertex_buffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertex) * msh->vertex_list.size(), &msh->vertex_list[0], GL_STATIC_DRAW);
-
-	glGenBuffers(1, &msh->index_buffer);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, msh->index_buffer);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint) * msh->index_list.size(), &msh->index_list[0], GL_STATIC_DRAW);
-
-	msh->vertex_array = cg_create_vertex_array(msh->vertex_buffer, msh->index_buffer);
-	if (!msh->vertex_array) { printf("%s(): failed to create vertex aray\n", __func__); return nullptr; }
-
-	return msh;
+	// full-screen image with the footprint of a quad at height * dist_view in front of the camera
+	float h = window_size.y * backheight / (2.0f * height * dist_view * tanf(cam.fovy / 2.0f)), w = h * backwidth / backheight;
+	vec2 c = vec2(float(window_size.x), float(window_size.y)) * 0.5f;
+	sprites.add(sprite_batch_t::BACKGROUND, tex, mip_sampler, c - vec2(w, h) * 0.5f, c + vec2(w, h) * 0.5f, vec2(0, 1), vec2(1, 0));
 }
 
-mesh* create_text_mesh(float width, float height)
+void clear_frame()
 {
-	mesh* msh = new mesh();
-
-	// TODO: Creating vertex buffer and index buffer of a rectangle
-	vector<vertex> vlist;
-	vector<uint> ilist = { 0,2,1,2,0,3 };
-	vertex v;
-	v.pos = vec3(-width / 2, 0, 0);				//left two vertex
-	v.norm = vec3(0, -1, 0);
-	v.tex = vec2(1.0f, .0f);
-
-	vlist.push_back(v);
-
-	v.pos = vec3(-width / 2, -height, 0);
-	v.tex = vec2(1.0f, 1.0f);
-	vlist.push_back(v);
-
-	v.pos = vec3(width / 2, -height, 0);			//right two vertex
-	//v.norm = vec3(-sinf(PI / 6), -cosf(PI / 6), 0);
-	v.tex = vec2(.0f, 1.0f);
-	vlist.push_back(v);
-
-	v.pos = vec3(width / 2, 0, 0);
-	v.tex = vec2(.0f, .0f);
-	vlist.push_back(v);
-
-	msh->vertex_list.resize(vlist.size());
-	msh->index_list.resize(ilist.size());
-	copy(vlist.begin(), vlist.end(), msh->vertex_list.begin());
-	copy(ilist.begin(), ilist.end(), msh->index_list.begin());
-
-	glGenBuffers(1, &msh->vertex_buffer);
-	glBindBuffer(GL_ARRAY_BUFFER, msh->vertex_buffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertex) * msh->vertex_list.size(), &msh->vertex_list[0], GL_STATIC_DRAW);
-
-	glGenBuffers(1, &msh->index_buffer);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, msh->index_buffer);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint) * msh->index_list.size(), &msh->index_list[0], GL_STATIC_DRAW);
-
-	msh->vertex_array = cg_create_vertex_array(msh->vertex_buffer, msh->index_buffer);
-	if (!msh->vertex_array) { printf("%s(): failed to create vertex aray\n", __func__); return nullptr; }
-
-	return msh;
+	// clear screen (with background color) and clear depth buffer
+	if (use_soft) softras.begin(window_size, clear_color);
+	else render_device_t::current().clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 }
 
-uint create_particle_varr()
+void draw_sprites(int layer)
 {
-	static vertex vertices[] = { {vec3(-1,-1,0),vec3(0,0,1),vec2(0,0)}, {vec3(1,-1,0),vec3(0,0,1),vec2(1,0)}, {vec3(-1,1,0),vec3(0,0,1),vec2(0,1)}, {vec3(1,1,0),vec3(0,0,1),vec2(1,1)} }; // strip ordering [0, 1, 3, 2]
-
-
-	// generation of vertex buffer: use vertices as it is
-	GLuint vertex_buffer;
-	glGenBuffers(1, &vertex_buffer);
-	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertex) * 4, &vertices[0], GL_STATIC_DRAW);
-
-	// generate vertex array object, which is mandatory for OpenGL 3.3 and higher
-	uint vertex_array = cg_create_vertex_array(vertex_buffer);
-	if (!vertex_array) { printf("%s(): failed to create vertex aray\n", __func__); return false; }
-	particles.resize(particle_t::MAX_PARTICLES);
-	return vertex_array;
+	if (!use_soft) { sprites.draw(layer); return; }
+	if (!softras.has_texture(hud.texture, hud.version)) softras.register_texture(hud.texture, hud_t::ROW_W, hud_t::ROW_H * hud_t::WIDGET_NUM, 1, &hud.pixels[0], hud.version);
+	softras.draw(sprites, layer);
 }
 
-void update()
+void flush_scene()
 {
-	// update projection matrix
-	cam.aspect = window_size.x / float(window_size.y);
-	cam.projection_matrix = mat4::perspective(cam.fovy, cam.aspect, cam.dnear, cam.dfar);
-
-	// build the model matrix for oscillating scale
-	float t = float(glfwGetTime());
-	//float scale	= 1.0f+float(cos(t*1.5f))*0.05f;
-	//mat4 model_matrix = mat4::scale( scale, scale, scale );
-
-	// update uniform variables in vertex/fragment shaders
-	GLint uloc;
-
-	for (auto& p : particles)p.update();
-
-
-	uloc = glGetUniformLocation(program, "view_matrix");			if (uloc > -1) glUniformMatrix4fv(uloc, 1, GL_TRUE, cam.view_matrix);
-	uloc = glGetUniformLocation(program, "projection_matrix");	if (uloc > -1) glUniformMatrix4fv(uloc, 1, GL_TRUE, cam.projection_matrix);
+	if (!use_soft)
+	{
+		// the field is opaque; obstacles, particles and the player are sorted together by depth
+		queue.sort();
+		pass_timer.begin("field");
+		queue.issue(render_queue_t::OPAQUE);
+		pass_timer.end();
+		pass_timer.begin("sorted");
+		queue.issue(render_queue_t::TRANSPARENT);
+		pass_timer.end();
+		queue.clear();
+		return;
+	}
+	queue.sort();
+	softras.draw(queue, cam.projection_matrix * cam.view_matrix);
+	queue.clear();
 }
 
-void rendertext(const string text, float xx, float yy)
+void present()
 {
-	int b_w = 512;
-	int b_h = 64;
-	int l_h = 64;
-
-	uchar* bitmap = (uchar*)calloc(b_w * b_h, sizeof(uchar));
-
-	float scale = stbtt_ScaleForPixelHeight(&finfo, l_h);
-
-	int x = 0;
-
-	int ascent, descent, linegap;
-	stbtt_GetFontVMetrics(&finfo, &ascent, &descent, &linegap);
-
-	ascent *= scale;
-	descent *= scale;
+	// swap front and back buffers, and display to screen; headless frames stay in the offscreen target
+	if (use_soft) { PROFILE_ZONE("resolve"); softras.resolve(); }
+	recorder.capture(headless.active ? headless.size : window_size, now());
+	if (!headless.active) { PROFILE_ZONE("glfwSwapBuffers"); glfwSwapBuffers(window); }
+	gl_state_t::instance().end_frame();
+	render_device_t::current().end_frame();
+}
 
-	for (auto it = text.begin(); it != text.end(); ++it)
+void register_passes()
+{
+	// the scene is drawn offscreen only while the composite pass dims it (pause) or upscales
+	// it (dynamic resolution); otherwise scene_target collapses onto the backbuffer and the
+	// passes draw straight to it. the HUD always draws at the window's resolution.
+	scene_target = graph.add_target("scene", true, true);
+	graph.add_pass("background", {}, { scene_target }, []() { clear_frame(); draw_sprites(sprite_batch_t::BACKGROUND); });
+	graph.add_pass("scene", {}, { scene_target }, []()
 	{
-		int ax;
-		int lsb;
-		stbtt_GetCodepointHMetrics(&finfo, *it, &ax, &lsb);
-		int c_x1, c_y1, c_x2, c_y2;
-		stbtt_GetCodepointBitmapBox(&finfo, *it, scale, scale, &c_x1, &c_y1, &c_x2, &c_y2);
-
-		/* compute y (different characters have different heights */
-		int y = ascent + c_y1;
-
-		/* render character (stride and offset is important here) */
-		int byteOffset = x + (lsb * scale) + (y * b_w);
-		stbtt_MakeCodepointBitmap(&finfo, bitmap + byteOffset, c_x2 - c_x1, c_y2 - c_y1, b_w, scale, scale, *it);
-
-		/* advance x */
-		x += ax * scale;
-
-		/* add kerning */
-		if (it + 1 != text.end())
-		{
-			int kern;
-			kern = stbtt_GetCodepointKernAdvance(&finfo, *it, *(it + 1));
-			x += kern * scale;
-		}
-	}
-	image *textimg;
-	int a, b;
-	uchar* png = stbi_write_png_to_mem(bitmap, b_w, b_w, b_h, 1, &a);
-	uchar* dat = stbi_load_from_memory(png, a, &b_w, &b_h, &b, 4);
-	//stbi_write_png("out.png", b_w, b_h, 2, bitmap, b_w);
-	//textimg = cg_load_image("out.png", true);
-
-	GLuint tt;
-	glGenTextures(1, &tt);
-	glBindTexture(GL_TEXTURE_2D, tt);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, b_w, b_h, 0, GL_RGBA, GL_UNSIGNED_BYTE, dat);
-
-	mat4 model_matrix = mat4::rotate(vec3(0, 0, 1), -map_angle) * mat4::translate(xx, yy, cam.eye.z + 5.0f);
-	GLint uloc = glGetUniformLocation(program, "model_matrix");
-	if (uloc > -1) glUniformMatrix4fv(uloc, 1, GL_TRUE, model_matrix);
-	glBindVertexArray(tMesh->vertex_array);
-	glDrawElements(GL_TRIANGLES, tMesh->index_list.size(), GL_UNSIGNED_INT, nullptr);
-	glDeleteTextures(1, &tt);
-
-	//stbi_write_png("out.png", b_w, b_h, 2, bitmap, b_w);
-
-	free(bitmap);
+		// blending stays on for the scene; the state cache drops these after the first frame
+		gl_state_t& gs = gl_state_t::instance();
+		gs.enable(gl_state_t::BLEND, true);
+		gs.blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		flush_scene();
+	});
+	graph.add_pass("composite", { scene_target }, { frame_graph_t::BACKBUFFER }, []() { draw_sprites(sprite_batch_t::COMPOSITE); }, []() { return (paused || dynres.scale() < 1.0f) && !use_soft; });
+	graph.add_pass("hud", {}, { frame_graph_t::BACKBUFFER }, []() { draw_sprites(sprite_batch_t::PANEL); draw_sprites(sprite_batch_t::OVERLAY); });
 }
 
-void render()
+void collect_sprites()
 {
-	GLint uloc;
-	mat4 model_matrix;
-	// clear screen (with background color) and clear depth buffer
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-	// notify GL that we use our own program
-	glUseProgram(program);
-	glEnable(GL_TEXTURE_2D);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-	// Draw background
-	glBindTexture(GL_TEXTURE_2D, texture[0]);
-	model_matrix = mat4::rotate(vec3(0,0,1), -map_angle) * mat4::translate(0, -backheight / 2, height * dist_view + cam.eye.z) * mat4::rotate(vec3(0, 0, 1), PI);
-
-	uloc = glGetUniformLocation(program, "model_matrix");
-	if (uloc > -1) glUniformMatrix4fv(uloc, 1, GL_TRUE, model_matrix);
-
-	if (bMesh && bMesh->vertex_array) glBindVertexArray(bMesh->vertex_array);
-	glDrawElements(GL_TRIANGLES, bMesh->index_list.size(), GL_UNSIGNED_INT, nullptr);
-
+	PROFILE_ZONE("collect_sprites");
+	// collect the screen-space quads of this frame: background behind the scene, HUD on top
+	hud.set_int(hud_t::SCORE, int((paused ? pause_time : now()) - start_time));	// frozen while paused
+	overlay.frame();
+	overlay.update(hud, window_size, pass_timer, uint(obstacles.size()), uint(particles.size()), dynres.scale());
+	hud.update(window_size);
+	sprites.begin(window_size);
+	add_backdrop(texture[0]);
+	if (!graph.on_backbuffer(scene_target))	// the offscreen scene, bilinearly upscaled to the window; dimmed while paused
+		sprites.add(sprite_batch_t::COMPOSITE, graph.texture(scene_target), clamp_sampler, vec2(0, 0), vec2(float(window_size.x), float(window_size.y)), vec2(0, 1), vec2(1, 0), paused ? vec4(0.5f, 0.5f, 0.5f, 1.0f) : vec4(1.0f));
+	hud.draw(sprites);
+	overlay.draw(sprites, hud, window_size);
+	sprites.upload();
+}
 
-	// Draw field
-	glBindTexture(GL_TEXTURE_2D, texture[1]);
+void submit_scene()
+{
+	PROFILE_ZONE("submit_scene");
+	draw_item_t item;
+	item.program = scene_shaders.get(0);
+	item.texture = scene_textures;
+	item.sampler = mip_sampler;
+
+	// Draw field: walls of the prism never overlap each other from inside, so they go
+	// through the opaque pass (still blended over the background)
+	item.layer = texture_layer[1];
+	geometry.bind(item, SHAPE_TILE);
 	int st = int(cam.eye.z / height);
 	for (int s = st; s < st + int(dist_view); s++)
 	{
 		for (int i = 0; i < NUM_RECT; i++)
 		{
-			//float t = float(glfwGetTime()) / 10.0f;
-			// TODO: generate model matrix
-
-			model_matrix = mat4::translate(vec3(0, 0, height * s)) * mat4::rotate(vec3(0, 0, 1), PI * i / 3);
-			uloc = glGetUniformLocation(program, "model_matrix");
-			if (uloc > -1) glUniformMatrix4fv(uloc, 1, GL_TRUE, model_matrix);
-
-			// bind vertex array object
-			if (mMesh && mMesh->vertex_array) glBindVertexArray(mMesh->vertex_array);
-
-			// render vertices: trigger shader programs to process vertex data
-			glDrawElements(GL_TRIANGLES, mMesh->index_list.size(), GL_UNSIGNED_INT, nullptr);
+			item.model_matrix = wall_transform(i, vec3(0, 0, height * s));
+			queue.submit(render_queue_t::OPAQUE, item, height * s + height / 2 - cam.eye.z);
 		}
 	}
 
 	// Draw obstacle
-	glBindTexture(GL_TEXTURE_2D, texture[2]);
-	for (auto it = obstacles.rbegin(); it != obstacles.rend(); ++it)
+	item.layer = texture_layer[2];
+	geometry.bind(item, SHAPE_OBSTACLE);
+	for (auto& ob : obstacles)
 	{
-		model_matrix = mat4::translate(vec3(0, 0, it->position)) * mat4::rotate(vec3(0, 0, 1), PI * it->wall_num / 3);
-		uloc = glGetUniformLocation(program, "model_matrix");
-		if (uloc > -1) glUniformMatrix4fv(uloc, 1, GL_TRUE, model_matrix);
-		else printf("model matrix find error\n");
-
-		if (oMesh && oMesh->vertex_array)glBindVertexArray(oMesh->vertex_array);
-
-
-		glDrawElements(GL_TRIANGLES, oMesh->index_list.size(), GL_UNSIGNED_INT, nullptr);
+		item.model_matrix = wall_transform(ob.wall_num, vec3(0, 0, ob.position));
+		queue.submit(render_queue_t::TRANSPARENT, item, ob.position - cam.eye.z);
 	}
 
-
-	//draw text
-	string scoreval = to_string(int(glfwGetTime() - start_time));
-	string scorestr = scorehead + scoreval;
-
-	rendertext(scorestr, -2.35f, 2.0f);
-
 	int player_loc = int(player_position / width);
 	float player_off = player_position - float(player_loc * width) - width / 2;
+	int player_wall = player_loc % NUM_RECT;		// player_position may sit right on 6 widths
+	vec3 player_base = wall_point(player_wall, -player_off, radius);	// on the wall, before the depth offset
 
 	{
-		glBindTexture(GL_TEXTURE_2D, texture[7]);
-		glBindVertexArray(part);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		draw_item_t pitem = item;
+		pitem.layer = texture_layer[7];
+		pitem.sampler = linear_sampler;
+		geometry.bind(pitem, SHAPE_PARTICLE);
+		pitem.program = scene_shaders.get(shader_variants_t::TINT);	// colored, fading particles
+		pitem.use_color = true;
 		for (auto& p : particles)
 		{
-			model_matrix = mat4::translate(vec3(p.pos.x, p.pos.y, 0)) * mat4::translate(vec3(0, 0, cam.eye.z + CAM_PLAYER_DISTANCE + 1.0f)) * mat4::rotate(vec3(0, 0, 1), PI * player_loc / 3)
-				* mat4::translate(vec3(-player_off, 0, 0)) * mat4::translate(vec3(0, radius, 0)) * mat4::scale(p.scale) * mat4::rotate(vec3(1, 0,0), PI);
-
-			uloc = glGetUniformLocation(program, "color");			if (uloc > -1) glUniform4fv(uloc, 1, p.color);
-			uloc = glGetUniformLocation(program, "model_matrix");		if (uloc > -1) glUniformMatrix4fv(uloc, 1, GL_TRUE, model_matrix);
-
-			glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+			// flipped upside down (a half turn about x) and scaled
+			pitem.model_matrix = wall_transform(player_wall, player_base + vec3(p.pos.x, p.pos.y, cam.eye.z + CAM_PLAYER_DISTANCE + 1.0f), vec3(p.scale, -p.scale, -p.scale));
+			pitem.color = p.color;
+			queue.submit(render_queue_t::TRANSPARENT, pitem, CAM_PLAYER_DISTANCE + 1.0f);
 		}
 	}
 
 	if (!dead)
 	{
 		//draw player
-		glBindTexture(GL_TEXTURE_2D, texture[3]);
-
-		model_matrix = mat4::translate(vec3(0, 0, cam.eye.z + CAM_PLAYER_DISTANCE)) * mat4::rotate(vec3(0, 0, 1), PI * player_loc / 3)
-			* mat4::translate(vec3(-player_off, 0, 0)) * mat4::translate(vec3(0, radius, 0));
-
-		uloc = glGetUniformLocation(program, "model_matrix");
-		if (uloc > -1) glUniformMatrix4fv(uloc, 1, GL_TRUE, model_matrix);
-
-		if (pMesh && pMesh->vertex_array)glBindVertexArray(pMesh->vertex_array);
-		glDrawElements(GL_TRIANGLES, pMesh->index_list.size(), GL_UNSIGNED_INT, nullptr);
+		item.layer = texture_layer[3];
+		geometry.bind(item, SHAPE_PLAYER);
+		item.model_matrix = wall_transform(player_wall, player_base + vec3(0, 0, cam.eye.z + CAM_PLAYER_DISTANCE));
+		queue.submit(render_queue_t::TRANSPARENT, item, CAM_PLAYER_DISTANCE);
 	}
-	
-	// swap front and back buffers, and display to screen
-	glfwSwapBuffers(window);
 }
 
-void render_start()
+void render()
 {
-	GLint uloc;
-	mat4 model_matrix;
-	// clear screen (with background color) and clear depth buffer
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-	// notify GL that we use our own program
-	glUseProgram(program);
-	glEnable(GL_TEXTURE_2D);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glBindTexture(GL_TEXTURE_2D, texture[4]);
-
-	model_matrix = mat4::translate(0, -backheight / 2, height * dist_view + cam.eye.z) * mat4::rotate(vec3(0, 0, 1), PI);
+	PROFILE_ZONE("render");
+	dynres.begin_frame();
+	pass_timer.begin_frame();
+	graph.set_scale(scene_target, dynres.scale());
+	graph.compile(window_size);
+
+	collect_sprites();
+	submit_scene();
+
+	// backdrop, sorted scene, then the HUD on top
+	graph.execute();
+	pass_timer.end_frame();
+	dynres.end_frame();
+	present();
+}
 
-	uloc = glGetUniformLocation(program, "model_matrix");
-	if (uloc > -1) glUniformMatrix4fv(uloc, 1, GL_TRUE, model_matrix);
+void render_start()
+{
+	clear_frame();
 
-	if (bMesh && bMesh->vertex_array) glBindVertexArray(bMesh->vertex_array);
-	glDrawElements(GL_TRIANGLES, bMesh->index_list.size(), GL_UNSIGNED_INT, nullptr);
-	glfwSwapBuffers(window);
+	sprites.begin(window_size);
+	add_backdrop(texture[4]);
+	sprites.upload();
+	draw_sprites(sprite_batch_t::BACKGROUND);
+	present();
 }
 
 void render_help()
 {
-	GLint uloc;
-	mat4 model_matrix;
-	// clear screen (with background color) and clear depth buffer
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	clear_frame();
 
-	// notify GL that we use our own program
-	glUseProgram(program);
-	glEnable(GL_TEXTURE_2D);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glBindTexture(GL_TEXTURE_2D, texture[6]);
-
-	model_matrix = mat4::translate(0, -backheight / 2, height * dist_view + cam.eye.z) * mat4::rotate(vec3(0, 0, 1), PI);
-
-	uloc = glGetUniformLocation(program, "model_matrix");
-	if (uloc > -1) glUniformMatrix4fv(uloc, 1, GL_TRUE, model_matrix);
-
-	if (bMesh && bMesh->vertex_array) glBindVertexArray(bMesh->vertex_array);
-	glDrawElements(GL_TRIANGLES, bMesh->index_list.size(), GL_UNSIGNED_INT, nullptr);
-	glfwSwapBuffers(window);
+	sprites.begin(window_size);
+	add_backdrop(texture[6]);
+	sprites.upload();
+	draw_sprites(sprite_batch_t::BACKGROUND);
+	present();
 }
 
 void render_end(float score)
 {
-	GLint uloc;
-	mat4 model_matrix;
-	// clear screen (with background color) and clear depth buffer
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-	// notify GL that we use our own program
-	glUseProgram(program);
-	glEnable(GL_TEXTURE_2D);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glBindTexture(GL_TEXTURE_2D, texture[5]);
-
-	model_matrix = mat4::rotate(vec3(0, 0, 1), -map_angle) * mat4::translate(0, -backheight / 2, height * dist_view + cam.eye.z) * mat4::rotate(vec3(0, 0, 1), PI);
-
-	uloc = glGetUniformLocation(program, "model_matrix");
-	if (uloc > -1) glUniformMatrix4fv(uloc, 1, GL_TRUE, model_matrix);
-
-	if (bMesh && bMesh->vertex_array) glBindVertexArray(bMesh->vertex_array);
-	glDrawElements(GL_TRIANGLES, bMesh->index_list.size(), GL_UNSIGNED_INT, nullptr);
-
-	rendertext(string(" Your Score: ") + to_string(int(score)), 0, 0.2f);
-
-	glfwSwapBuffers(window);
+	clear_frame();
+
+	hud.set_int(hud_t::RESULT, int(score));
+	hud.update(window_size);
+	sprites.begin(window_size);
+	add_backdrop(texture[5]);
+	hud.draw(sprites);
+	overlay.draw(sprites, hud, window_size);
+	sprites.upload();
+	draw_sprites(sprite_batch_t::BACKGROUND);
+	draw_sprites(sprite_batch_t::PANEL);
+	draw_sprites(sprite_batch_t::OVERLAY);
+
+	present();
 }
 
 bool isfullscreen()
@@ -603,7 +434,14 @@ void reshape(GLFWwindow* window, int width, int height)
 	// set current viewport in pixels (win_x, win_y, win_width, win_height)
 	// viewport: the window area that are affected by rendering 
 	window_size = ivec2(width, height);
-	glViewport(0, 0, width, height);
+	gl_state_t::instance().viewport(window_size);
+	redraw = true;
+}
+
+void refresh(GLFWwindow* window)
+{
+	// the window system lost our contents (e.g., uncovered); repaint static screens
+	redraw = true;
 }
 
 void toggle_fullscreen(bool fullscreen)
@@ -633,6 +471,14 @@ void toggle_fullscreen(bool fullscreen)
 	reshape(window, width, height);
 }
 
+void capture_trace()
+{
+	// records from now to the end of the next presented frame
+	if (!tracer) { printf("start with --trace DIR to capture frame traces\n"); return; }
+	char name[32]; snprintf(name, sizeof(name), "/frame_%05d.trace", frame);
+	tracer->begin((trace_dir + name).c_str());
+}
+
 void print_help()
 {
 	printf("[help]\n");
@@ -640,6 +486,9 @@ void print_help()
 	printf("- press 'q' to retire the game\n");
 	printf("- press 'p' to pause the game\n");
 	printf("- press F1 or 'h' to see help\n");
+	printf("- press F3 to show frame times and counters\n");
+	printf("- press F11 to write a CPU profile of the last seconds (PRISM_PROFILE builds)\n");
+	printf("- press F12 to capture a frame trace (with --trace)\n");
 	printf("- press Left or Right to move charactor\n");
 	printf("\n");
 }
@@ -652,6 +501,7 @@ void keyboard(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
 
 	// TODO: Implementing keyboard action
+	redraw = true;
 
 	if (action == GLFW_PRESS)
 	{
@@ -660,25 +510,34 @@ void keyboard(GLFWwindow* window, int key, int scancode, int action, int mods)
 			full = !full;
 			toggle_fullscreen(full);
 		}
+		else if (key == GLFW_KEY_F12) capture_trace();
+		else if (key == GLFW_KEY_F3)
+		{
+			if (!pass_timer.enabled) pass_timer.init(true);	// CPU and GPU times from here on
+			overlay.set_visible(hud, !overlay.visible);
+		}
+		else if (key == GLFW_KEY_F11) profile_write(profile_path.c_str(), profile_seconds);
 		else if (state_game == 0) {
 			if (key == GLFW_KEY_H || key == GLFW_KEY_F1)	help = !help;
 			if(key == GLFW_KEY_1){
 				map_v = 0;
 				map_c = 999999999.0f;
 				state_game = 1;
+				hud.set_text(hud_t::MODE, "Easy");
 
 			}
 			else if(key==GLFW_KEY_2){
 				map_v = rand_range(MIN_MAP_V, MAX_MAP_V);
-				map_c = float(glfwGetTime()) + rand_range(MIN_MAP_C, MAX_MAP_C);
+				map_c = now() + rand_range(MIN_MAP_C, MAX_MAP_C);
 				state_game = 1;
+				hud.set_text(hud_t::MODE, "Hard");
 
 			}
 		}
 		else if (key == GLFW_KEY_Q)
 		{
 			state_game = 0;
-			pause = 0;
+			paused = 0;
 		}
 		else if (key == GLFW_KEY_LEFT) {
 			state_left = 1;
@@ -687,16 +546,16 @@ void keyboard(GLFWwindow* window, int key, int scancode, int action, int mods)
 			state_right = 1;
 		}
 		else if (key == GLFW_KEY_P) {
-			if (pause == 0) {
-				pause = 1;
-				pause_time = float(glfwGetTime());
+			if (paused == 0) {
+				paused = 1;
+				pause_time = now();
 			}
-			else if (pause == 1) {
-				float temp = float(glfwGetTime()) - pause_time;
+			else if (paused == 1) {
+				float temp = now() - pause_time;
 				map_c += temp;
 				ob_time += temp;
 				start_time += temp;
-				pause = 0;
+				paused = 0;
 			}
 		}
 
@@ -719,79 +578,133 @@ void motion(GLFWwindow* window, double x, double y)
 {
 }
 
+bool create_programs()
+{
+	// every program goes in first, so their compiles overlap on driver threads;
+	// nothing queries them before link_programs()
+	// - the variants the scene draws with: plain textured, and tinted for particles
+	scene_shaders.init(vert_shader, frag_shader);
+	if (!scene_shaders.get(0) || !scene_shaders.get(shader_variants_t::TINT)) return false;
+	if (!sprites.init(sprite_vert, sprite_frag)) { printf("sprite batcher init failed\n"); return false; }
+	return true;
+}
+
+bool link_programs()
+{
+	// waits for what is still linking, then looks up uniforms and block bindings
+	if (strcmp(render_device_t::current().name(), "gl") == 0 && !gl_device_t::instance().programs.finish()) return false;
+	for (auto& v : scene_shaders.programs) { camera_block.attach(v.second); queue.register_program(v.second); }
+	sprites.locate();
+	gl_state_t::instance().invalidate();
+	return true;
+}
+
 bool user_init()
 {
 	// log hotkeys
 	print_help();
 
 	// init GL states
-	glClearColor(39 / 255.0f, 40 / 255.0f, 34 / 255.0f, 1.0f);	// set clear color
-	glEnable(GL_CULL_FACE);								// turn on backface culling
-	glEnable(GL_DEPTH_TEST);								// turn on depth tests
-	glEnable(GL_TEXTURE_2D);
-	glActiveTexture(GL_TEXTURE0);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	render_device_t& rd = render_device_t::current();
+	rd.clear_color(clear_color);						// set clear color
+	rd.enable(GL_CULL_FACE, true);						// turn on backface culling
+	rd.enable(GL_DEPTH_TEST, true);						// turn on depth tests
+	rd.active_texture(0);
+	rd.blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	// wireframe
 	//glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
-	mMesh = create_rectangle_mesh(width, height);
-	oMesh = create_obstacle_mesh(width, radius / 2);
-	pMesh = create_player_mesh(width / 5, width / 5);
-	bMesh = create_player_mesh(backwidth, backheight);
-	tMesh = create_text_mesh(width / 4, width / 16);
-	part = create_particle_varr();
+	if (!create_shapes()) return false;
+	particles.resize(particle_t::MAX_PARTICLES);
+	camera_block.init();
 
-	glGenTextures(texture_num, texture);
-	image *data;
-	for (uint i = 0; i < texture_num; i++)
+	// textures and the font load on workers, the title screen first; cooked textures
+	// carry their mip levels, so each upload comes straight from the file mapping.
+	// the scene textures fill the layers of one array, so the scene binds a single texture.
+	scene_textures = rd.create_texture_array(scene_layer_size, render_device_t::level_count(scene_layer_size), 4);
+	for (uint k = 0; k < texture_num; k++)
 	{
-		data = cg_load_image(texture_path[i], texture_alpha[i]);
-		if (data == NULL)
+		uint i = (k + 4) % texture_num;		// title, gameover, howto, particle, bg, tiles, obstacle, player
+		if (texture_layer[i] >= 0)
 		{
-			printf("Texture file load failed %d\n", i);
-			return false;
+			loader.add_texture_layer(texture_path[i], scene_textures, texture_layer[i], scene_layer_size, [](asset_loader_t::asset_t& a)
+			{
+				if (use_soft) softras.register_texture_layer(a.name, a.layer, a.texture.size().x, a.texture.size().y, a.texture.channels(), a.texture.pixels());
+				return true;
+			});
+			continue;
 		}
-		glBindTexture(GL_TEXTURE_2D, texture[i]);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB + int(texture_alpha[i]), data->width, data->height, 0, GL_RGB + int(texture_alpha[i]), GL_UNSIGNED_BYTE, data->ptr);
-		glGenerateMipmap(GL_TEXTURE_2D);
-		free(data);
+		int id = loader.add_texture(texture_path[i], texture_alpha[i], [i](asset_loader_t::asset_t& a)
+		{
+			texture[i] = a.name;
+			if (use_soft) softras.register_texture(texture[i], a.texture.size().x, a.texture.size().y, a.texture.channels(), a.texture.pixels());
+			if (i == 6) redraw = true;		// the help screen may be up already
+			return true;
+		});
+		if (i == 4) title_asset = id;
 	}
-
-	long size;
-	uchar* fontbuf;
-
-	FILE* fontfile = fopen("font/LBRITE.TTF", "rb");
-	fseek(fontfile, 0, SEEK_END);
-	size = ftell(fontfile);
-	fseek(fontfile, 0, SEEK_SET);
-
-	fontbuf = (uchar*)malloc(size);
-
-	fread(fontbuf, size, 1, fontfile);
-	fclose(fontfile);
-
-	if (!stbtt_InitFont(&finfo, fontbuf, 0)) {
+	loader.add_file("font/LBRITE.TTF", [](asset_loader_t::asset_t& a)
+	{
+		font_data.swap(a.data);		// keeps a loose file's bytes alive; a.bytes still points at them
+		if (stbtt_InitFont(&finfo, a.bytes, 0)) return true;
 		printf("font init failed\n");
 		return false;
+	});
+	if (window) loader.wake = glfwPostEmptyEvent;
+	if (pack.open()) { loader.pack = &pack; printf("assets: pack %s with %u entries\n", pack.source.c_str(), pack.count); }
+	loader.start();
+
+	// sampling state lives in sampler objects, so textures are never re-parameterized per frame
+	mip_sampler = rd.create_sampler(GL_NEAREST_MIPMAP_LINEAR, GL_LINEAR, GL_REPEAT);
+	linear_sampler = rd.create_sampler(GL_LINEAR, GL_LINEAR, GL_REPEAT);
+	clamp_sampler = rd.create_sampler(GL_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE);
+	if (use_soft)
+	{
+		softras.register_sampler(mip_sampler, true, true);
+		softras.register_sampler(linear_sampler, true, false);
+		softras.register_sampler(clamp_sampler, false, false);
+		softras.register_mesh(geometry.vertex_array, &geometry.vertices[0], geometry.vertices.size(), &geometry.indices[0], geometry.indices.size());
 	}
 
+	queue.dfar = cam.dfar;
+	if (!hud.init(&finfo, clamp_sampler)) { printf("hud init failed\n"); return false; }
+	if (!overlay.init(hud, clamp_sampler)) { printf("overlay init failed\n"); return false; }
+	if (use_soft) { static const uchar white = 255; softras.register_texture(overlay.texture, 1, 1, 1, &white); }
+	register_passes();
+	graph.timer = &pass_timer;
+
+	// everything above went around the state cache
+	gl_state_t::instance().invalidate();
 	return true;
 }
 
 void user_finalize()
 {
-	free(mMesh);
-	free(bMesh);
-	free(oMesh);
-	free(tMesh);
-	free(pMesh);
+	recorder.end();
+	if (use_soft) softras.finalize();
+	hud.finalize();
+	overlay.finalize();
+	sprites.finalize();
+	scene_shaders.finalize();
+	camera_block.finalize();
+	geometry.finalize();
+	graph.finalize();
+	dynres.finalize();
+	pacer.finalize();
+	pass_timer.finalize();
+	render_device_t& rd = render_device_t::current();
+	rd.destroy(render_device_t::SAMPLER, mip_sampler);
+	rd.destroy(render_device_t::SAMPLER, linear_sampler);
+	rd.destroy(render_device_t::SAMPLER, clamp_sampler);
+	rd.destroy(render_device_t::TEXTURE, scene_textures);
 }
 
 void create_obstacle() {
+	PROFILE_ZONE("create_obstacle");
 	int flag[6] = { 0, };
 	int num = rand() % 6 ;
 	if (map_v != 0)num++;
-	if (int(glfwGetTime() - start_time) >= 60) num++;
+	if (int(now() - start_time) >= 60) num++;
 	switch(num){
 	case 7:
 	case 6:
@@ -824,7 +737,7 @@ void create_obstacle() {
 }
 
 void game_initialize() {
-	srand((int)time(NULL));
+	srand(headless.active ? 0u : uint(time(NULL)));	// headless runs must reproduce the same frames
 	obstacles.clear();
 	cam.eye.z =0;
 	cam.at.z = cam.eye.z + 1;
@@ -835,14 +748,30 @@ void game_initialize() {
 	cam.view_matrix = mat4::look_at(cam.eye, cam.at, cam.up);
 	
 	player_position = 3.5f * width;
-	float t = float(glfwGetTime());
+	float t = now();
 	start_time = t;
 	create_obstacle();
 	ob_time =t+ OBS_CREATE_TIME;
+
+	fps_time = t;
+	fps_frames = 0;
+	gl_state_t::instance().reset_totals();
+	null_device.reset();
+	dynres.reset();
+	pacer.reset();
+	pass_timer.reset();
+	hud.set_int(hud_t::BEST, best_score);
+	hud.set_anchor(hud_t::BEST, vec2(0.76f, 0.017f + hud_t::TEXT_H));
+	hud.set_visible(hud_t::SCORE, true);
+	hud.set_visible(hud_t::BEST, true);
+	hud.set_visible(hud_t::MODE, true);
+	hud.set_visible(hud_t::FPS, true);
+	hud.set_visible(hud_t::RESULT, false);
 }
 
 int game_update() {
-	float t = float(glfwGetTime());
+	PROFILE_ZONE("game_update");
+	float t = now();
 	if (t >= ob_time) {
 		create_obstacle();
 		ob_time += OBS_CREATE_TIME;
@@ -864,17 +793,20 @@ int game_update() {
 		player_position = player_position > width * 6 ? player_position - width * 6 : player_position;
 	}
 	//obstacle crush check, remove
-	vector<obstacle>::iterator it = obstacles.begin();
-	while (it != obstacles.end()) {
-		if (it->position < cam.eye.z + CAM_PLAYER_DISTANCE) {
-			if (it->wall_num * width <= player_position + width / 10 && (it->wall_num + 1) * width >= player_position - width / 10) {
-				return -1;
+	{
+		PROFILE_ZONE("collisions");
+		vector<obstacle>::iterator it = obstacles.begin();
+		while (it != obstacles.end()) {
+			if (it->position < cam.eye.z + CAM_PLAYER_DISTANCE) {
+				if (it->wall_num * width <= player_position + width / 10 && (it->wall_num + 1) * width >= player_position - width / 10) {
+					return -1;
+				}
+
+				it = obstacles.erase(it);
+			}
+			else {
+				it++;
 			}
-
-			it = obstacles.erase(it);
-		}
-		else {
-			it++;
 		}
 	}
 	//cam update
@@ -894,66 +826,292 @@ int game_update() {
 	return 0;
 }
 
+void count_fps(float t)
+{
+	// refresh the fps widget once per second
+	fps_frames++;
+	if (t - fps_time >= 1.0f) {
+		hud.set_int(hud_t::FPS, int(fps_frames / (t - fps_time) + 0.5f));
+		fps_time = t;
+		fps_frames = 0;
+	}
+}
+
+float game_over()
+{
+	// todo:print score, game over
+	state_game = 0;
+	float score = now() - start_time;
+	printf("Your Score: %02lf\n", score);
+	{
+		const gl_state_t& gs = gl_state_t::instance();
+		if (gs.frames) printf("GL state calls per frame: %.1f issued, %.1f elided, %.1f draws\n",
+			double(gs.total[gl_state_t::ISSUED]) / gs.frames, double(gs.total[gl_state_t::ELIDED]) / gs.frames, double(gs.total[gl_state_t::DRAWS]) / gs.frames);
+	}
+	dynres.print();
+	if (window) pacer.print();
+	pass_timer.print();
+	if (int(score) > best_score) best_score = int(score);
+	hud.set_int(hud_t::BEST, best_score);
+	hud.set_anchor(hud_t::BEST, vec2(0.5f, 0.4517f + hud_t::TEXT_H), hud_widget_t::CENTER);
+	hud.set_visible(hud_t::SCORE, false);
+	hud.set_visible(hud_t::MODE, false);
+	hud.set_visible(hud_t::FPS, false);
+	hud.set_visible(hud_t::RESULT, true);
+	return score;
+}
+
+void write_frame(const char* name)
+{
+	if (!use_soft) { if (headless.readable()) headless.write(name); return; }
+	softras.write((headless.out_dir + "/" + name + ".png").c_str());
+}
+
+int run_headless(int frames, int capture_interval, int mode, int trace_frame)
+{
+	// scripted run at a fixed 60 Hz virtual clock: title, gameplay until death or
+	// the frame limit, then game over; render() is timed up to GPU completion
+	char name[64];
+	srand(0);
+	update();
+	render_start();
+	write_frame("title");
+
+	keyboard(window, mode == 1 ? GLFW_KEY_1 : GLFW_KEY_2, 0, GLFW_PRESS, 0);
+	game_initialize();
+
+	double total_ms = 0, min_ms = 1e9, max_ms = 0;
+	int n = 0;
+	for (frame = 0; frame < frames; frame++)
+	{
+		headless.clock += 1.0 / 60;
+		if (game_update()) break;
+		if (frame == trace_frame) capture_trace();
+
+		auto t0 = std::chrono::steady_clock::now();
+		update();
+		render();
+		render_device_t::current().finish();
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+		total_ms += ms; min_ms = min(min_ms, ms); max_ms = max(max_ms, ms); n++;
+		count_fps(now());
+
+		if (capture_interval > 0 && frame % capture_interval == 0) { snprintf(name, sizeof(name), "frame_%05d", frame); write_frame(name); }
+	}
+
+	float score = game_over();
+	update();
+	render_end(score);
+	write_frame("gameover");
+
+	if (n) printf("headless (%s): %d frames at %dx%d, render %.3f ms avg, %.3f min, %.3f max (%.1f fps)\n", use_soft ? "soft" : render_device_t::current().name(), n, headless.size.x, headless.size.y, total_ms / n, min_ms, max_ms, 1000.0 * n / total_ms);
+	return 0;
+}
+
 int main(int argc, char* argv[])
 {
+	// headless mode: --headless [--frames N] [--capture K] [--out DIR] [--size WxH] [--mode 1|2] [--soft [--threads N]]
+	//   --device null|record: no GL context; count the calls of a frame, or also keep them and write <out>/commands.txt
+	//   --soft rasterizes on the CPU and needs no GL either; it implies --device null unless record is given
+	// frame traces: --trace DIR [--trace-frame N] captures on F12 (or at frame N) into DIR/frame_<n>.trace;
+	//   --replay FILE [--loops N] re-executes one on a window, with --headless, or with --device null
+	// recording (GL only): --record DIR for a PNG sequence, or --record FILE.y4m
+	// assets: --cook rebuilds textures/*.ptex and assets.pack from the sources and exits; without a pack, missing
+	//   or stale .ptex files are cooked at startup. a pack (embedded, next to the executable, or here) takes precedence
+	//   over loose files; only a pack found here gives way to the ones that have changed since it was cooked.
+	// programs: linked programs are cached in programs.cache next to the executable, or here if that is unknown
+	// resolution: --scale auto|S renders the scene at S (0.5 to 1) of the window, or adapts it to hold 60 fps;
+	//   auto by default on a window, 1 headless (auto needs a GL context; the software rasterizer stays at 1)
+	// pacing (window): --pacing vsync|adaptive|limiter; vsync by default (see frame_pacer.h)
+	// profiling (GL only): --pass-times prints the GPU and CPU time of each pass at game over (see pass_timer.h)
+	//   --overlay shows frame times, draw and uniform counts on screen from the start (F3 toggles it; see perf_overlay.h)
+	//   --profile FILE writes the CPU zones of the last 10 s at exit (and on F11) as a Chrome trace (PRISM_PROFILE builds; see profiler.h)
+	PROFILE_THREAD("main");
+	bool use_headless = false;
+	const char* record_path = nullptr;
+	const char* device_name = nullptr;	// gl, or null with --soft
+	const char* replay_path = nullptr;
+	int trace_frame = -1, loops = 100;
+	const char* scale_option = nullptr;
+	int pacing = frame_pacer_t::VSYNC;
+	bool pass_times = false, profile = false, show_overlay = false;
+	int frames = 600, capture_interval = 0, mode = 2, soft_threads = 0;
+	for (int k = 1; k < argc; k++)
+	{
+		if (strcmp(argv[k], "--headless") == 0) use_headless = true;
+		else if (strcmp(argv[k], "--frames") == 0 && k + 1 < argc) frames = atoi(argv[++k]);
+		else if (strcmp(argv[k], "--capture") == 0 && k + 1 < argc) capture_interval = atoi(argv[++k]);
+		else if (strcmp(argv[k], "--out") == 0 && k + 1 < argc) headless.out_dir = argv[++k];
+		else if (strcmp(argv[k], "--size") == 0 && k + 1 < argc) sscanf(argv[++k], "%dx%d", &window_size.x, &window_size.y);
+		else if (strcmp(argv[k], "--mode") == 0 && k + 1 < argc) mode = atoi(argv[++k]);
+		else if (strcmp(argv[k], "--record") == 0 && k + 1 < argc) record_path = argv[++k];
+		else if (strcmp(argv[k], "--soft") == 0) use_soft = true;
+		else if (strcmp(argv[k], "--threads") == 0 && k + 1 < argc) soft_threads = atoi(argv[++k]);
+		else if (strcmp(argv[k], "--device") == 0 && k + 1 < argc) device_name = argv[++k];
+		else if (strcmp(argv[k], "--trace") == 0 && k + 1 < argc) trace_dir = argv[++k];
+		else if (strcmp(argv[k], "--trace-frame") == 0 && k + 1 < argc) trace_frame = atoi(argv[++k]);
+		else if (strcmp(argv[k], "--replay") == 0 && k + 1 < argc) replay_path = argv[++k];
+		else if (strcmp(argv[k], "--loops") == 0 && k + 1 < argc) loops = atoi(argv[++k]);
+		else if (strcmp(argv[k], "--scale") == 0 && k + 1 < argc) scale_option = argv[++k];
+		else if (strcmp(argv[k], "--pass-times") == 0) pass_times = true;
+		else if (strcmp(argv[k], "--overlay") == 0) show_overlay = true;
+		else if (strcmp(argv[k], "--profile") == 0 && k + 1 < argc) { profile_path = argv[++k]; profile = true; }
+		else if (strcmp(argv[k], "--pacing") == 0 && k + 1 < argc)
+		{
+			for (pacing = 0; pacing < frame_pacer_t::MODE_NUM && strcmp(argv[k + 1], frame_pacer_t::mode_name(pacing)) != 0; pacing++);
+			if (pacing == frame_pacer_t::MODE_NUM) { printf("--pacing takes vsync, adaptive or limiter\n"); return 1; }
+			k++;
+		}
+		else if (strcmp(argv[k], "--cook") == 0)
+		{
+			std::vector<std::pair<std::string, std::string>> items = { { "font/LBRITE.TTF", "font/LBRITE.TTF" } };
+			for (uint i = 0; i < texture_num; i++)
+			{
+				items.push_back({ texture_path[i], cooked_path(texture_path[i]) });
+				if (!cook_texture(texture_path[i], texture_alpha[i], items.back().second.c_str(), texture_layer[i] >= 0 ? scene_layer_size : ivec2(0, 0))) return 1;
+			}
+			if (!write_asset_pack("assets.pack", items)) return 1;
+			printf("cooked %u textures into assets.pack\n", texture_num);
+			return 0;
+		}
+		else { printf("unknown option: %s\n", argv[k]); return 1; }
+	}
+
+	if (use_soft && (!use_headless || record_path)) { printf("--soft needs --headless and does not record\n"); return 1; }
+	bool auto_scale = scale_option ? strcmp(scale_option, "auto") == 0 : !use_headless;
+	float fixed_scale = scale_option && !auto_scale ? float(atof(scale_option)) : 1.0f;
+	if (fixed_scale < 0.5f || fixed_scale > 1.0f) { printf("--scale takes auto or 0.5 to 1\n"); return 1; }
+
+	if (!device_name) device_name = use_soft ? "null" : "gl";
+	bool gl_context = strcmp(device_name, "gl") == 0;
+	if (use_soft && gl_context) { printf("--soft renders without GL; use --device null or record\n"); return 1; }
+	if (strcmp(device_name, "null") == 0) render_device_t::select(&null_device);
+	else if (strcmp(device_name, "record") == 0) render_device_t::select(&record_device);
+	else if (!gl_context) { printf("unknown device: %s\n", device_name); return 1; }
+	if (!gl_context && !replay_path && (!use_headless || record_path)) { printf("--device %s needs --headless and does not record\n", device_name); return 1; }
+
+	if (replay_path)
+	{
+		frame_trace_t trace;
+		if (!trace.load(replay_path)) return 1;
+		if (use_headless || !gl_context) { if (!headless.init(window_size, gl_context)) return 1; }
+		else if (!(window = cg_create_window(window_name, window_size.x, window_size.y, gl_version_t::major_default, gl_version_t::minor_default, false)) || !cg_init_extensions(window)) { glfwTerminate(); return 1; }
+		trace.replay(render_device_t::current(), loops);
+		if (headless.readable()) headless.write("replay");
+		if (window) glfwTerminate();
+		headless.finalize();
+		return 0;
+	}
+
+	if (!trace_dir.empty()) render_device_t::select(tracer = new trace_device_t(render_device_t::current()));
+	else if (trace_frame >= 0) { printf("--trace-frame needs --trace DIR\n"); return 1; }
+
+	if (use_headless)
+	{
+		if (!headless.init(window_size, gl_context)) return 1;
+		if (gl_context) gl_device_t::instance().programs.init((executable_dir() + "programs.cache").c_str(), headless_t::proc_address());
+		if (use_soft) softras.init(soft_threads);
+		dynres.init(auto_scale && gl_context && !use_soft, use_soft ? 1.0f : fixed_scale);
+		pass_timer.init((pass_times || show_overlay) && gl_context && !use_soft);
+		if (!create_programs()) return 1;
+		if (!user_init() || !loader.finish() || !link_programs()) { printf("Failed to user_init()\n"); return 1; }
+		overlay.set_visible(hud, show_overlay);
+		reshape(window, window_size.x, window_size.y);
+		if (record_path && !recorder.begin(record_path, true)) return 1;
+		int result = run_headless(frames, capture_interval, mode, trace_frame);
+		if (profile) profile_write(profile_path.c_str(), profile_seconds);
+		user_finalize();
+		headless.finalize();
+		if (!gl_context && !use_soft) null_device.print();
+		if (strcmp(device_name, "record") == 0 && record_device.frames() >= 2)
+		{
+			// the last gameplay frame; the one after it is the game-over screen
+			std::string path = headless.out_dir + "/commands.txt";
+			if (FILE* fp = fopen(path.c_str(), "w")) { record_device.dump(fp, record_device.frames() - 2); fclose(fp); }
+			printf("recorded %zu commands in %u frames; last gameplay frame written to %s\n", record_device.commands.size(), record_device.frames(), path.c_str());
+		}
+		return result;
+	}
+
 	// create window and initialize OpenGL extensions
 	if (!(window = cg_create_window(window_name, window_size.x, window_size.y))) { glfwTerminate(); return 1; }
 	if (!cg_init_extensions(window)) { glfwTerminate(); return 1; }	// version and extensions
+	double window_ms = ms_since(launch_time);
+	gl_device_t::instance().programs.init((executable_dir() + "programs.cache").c_str(), (GLADloadproc)glfwGetProcAddress);
 
 	// initializations and validations
-	if (!(program = cg_create_program_from_string(vert_shader, frag_shader))) { glfwTerminate(); return 1; }	// create and compile shaders/program
+	if (!create_programs()) { glfwTerminate(); return 1; }	// create and compile shaders/program
+	dynres.init(auto_scale, fixed_scale);
+	pass_timer.init(pass_times || show_overlay);
+	if (!pacer.init(pacing, 60, glfwGetVideoMode(glfwGetPrimaryMonitor())->refreshRate)) { glfwTerminate(); return 1; }
 	if (!user_init()) { printf("Failed to user_init()\n"); glfwTerminate(); return 1; }					// user initialization
+	overlay.set_visible(hud, show_overlay);
+	if (record_path && !recorder.begin(record_path)) { glfwTerminate(); return 1; }
 
 	// register event callbacks
 	glfwSetWindowSizeCallback(window, reshape);	// callback for window resizing events
+	glfwSetWindowRefreshCallback(window, refresh);	// callback for damaged window contents
 	glfwSetKeyCallback(window, keyboard);			// callback for keyboard events
 	glfwSetMouseButtonCallback(window, mouse);	// callback for mouse click inputs
 	glfwSetCursorPosCallback(window, motion);		// callback for mouse movement
 
-	update();
+	// programs still linking on driver threads are checked (and cached) before the first frame;
+	// the title screen shows as soon as its texture is in, and the rest keeps streaming
+	if (!link_programs()) { printf("Failed to create programs\n"); glfwTerminate(); return 1; }
+	if (!loader.wait(title_asset)) { printf("Failed to load the title screen\n"); glfwTerminate(); return 1; }
+	bool first_frame = true;
+
+	// title and help screens are static: block until an event asks for a repaint
+	// - workers post an empty event per loaded asset, so uploads happen here too
 	while(!state_game && !glfwWindowShouldClose(window)){
-		glfwPollEvents();
-		update();
-		if (help) render_help();
-		else render_start();
+		if (redraw) {
+			update();
+			if (help) render_help();
+			else render_start();
+			redraw = false;
+			if (first_frame) { printf("first frame %.1f ms after launch (window ready at %.1f ms)\n", ms_since(launch_time), window_ms); first_frame = false; }
+		}
+		loader.upload();
+		glfwWaitEvents();
 	}
+	if (!loader.finish()) { printf("Failed to load assets\n"); glfwTerminate(); return 1; }
 	float score;
 	
 	while (!glfwWindowShouldClose(window)) {
 		game_initialize();
 		// enters rendering/event loop
-		int time_count = 0;
-		float ctime;
+		pacer.restart();
 		for (frame = 0; !glfwWindowShouldClose(window);)
 		{
-			if (time_count == 0) {
-				ctime = float(glfwGetTime());
-				time_count++;
-			}
-			if (ctime + 1.0f / 60 <= glfwGetTime()) {
-				frame++;
-				glfwPollEvents();	// polling and processing of events
-				if (pause) continue;
-				if (game_update()) break;
-				update();			// per-frame update
-				render();			// per-frame render
-				time_count = 0;
+			{ PROFILE_ZONE("pace"); pacer.wait(); }		// the next frame is due (vsync, or the limiter's sleep)
+			frame++;
+			{ PROFILE_ZONE("glfwPollEvents"); glfwPollEvents(); }	// polling and processing of events
+			if (paused) {
+				// keep the paused frame on screen and sleep until input
+				if (redraw) { update(); render(); redraw = false; }
+				glfwWaitEvents();
+				pacer.restart();
+				continue;
 			}
+			if (game_update()) break;
+			if (frame == trace_frame) capture_trace();
+			update();			// per-frame update
+			render();			// per-frame render
+
+			count_fps(now());
 		}
-		// todo:print score, game over
-		state_game = 0;
-		printf("Your Score: %02lf\n", float(glfwGetTime()) - start_time);
-		score = float(glfwGetTime()) - start_time;
+		score = game_over();
 		render_end(score);
-		Sleep(100);
+		frame_pacer_t::sleep(0.1);	// keys still held from the game do not skip the game-over screen
 		
+		redraw = false;
 		while(!state_game && !glfwWindowShouldClose(window)){
-			glfwPollEvents();
-			update();
-			render_end(score);
+			glfwWaitEvents();
+			if (redraw && !state_game) { update(); render_end(score); redraw = false; }
 		}
 	}
 	// normal termination
+	if (profile) profile_write(profile_path.c_str(), profile_seconds);
 	user_finalize();
 
 	return 0;
@@ -0,0 +1,167 @@
+#ifndef __PASS_TIMER_H__
+#define __PASS_TIMER_H__
+#pragma once
+
+#include "cgmath.h"
+#include "cgut.h"
+
+#include <chrono>
+
+// GPU and CPU time of named zones of a frame, e.g., the passes of the frame graph.
+// - a zone is a pair of GL_TIMESTAMP queries, so zones nest and run inside the
+//   GL_TIME_ELAPSED query of dynamic resolution; the frame itself is the outermost zone.
+// - queries sit in a ring FRAMES deep and are read back only once the frame's last one is
+//   available, so reading never stalls; with the ring full, a frame goes untimed.
+// - CPU time is the submission time of the zone's calls, on the clock.
+// - each zone keeps its last HISTORY samples for rolling averages and percentiles.
+// - software GL rasterizes at the flush, after the queries; there GPU times show little.
+struct pass_timer_t
+{
+	static constexpr int FRAMES = 4;		// frames in flight
+	static constexpr int MAX_ZONES = 16;	// per frame, nested ones included
+	static constexpr int HISTORY = 240;
+
+	typedef std::chrono::steady_clock steady_t;
+	struct zone_t { const char* name; int depth; uint count; float gpu[HISTORY], cpu[HISTORY]; };	// count: samples since reset()
+	struct record_t { int zone; GLuint begin, end; steady_t::time_point start; float cpu; };
+	struct frame_t { record_t records[MAX_ZONES]; int n; };
+	struct stats_t { float avg, p50, p99; };
+
+	bool	enabled = false;
+	std::vector<zone_t>	zones;		// in the order first seen
+	frame_t	frames[FRAMES];
+	uint	issued = 0, read = 0;		// frames timed, frames read back
+	uint	skipped = 0;				// frames untimed on a full ring, since reset()
+	bool	timing = false;				// the current frame is timed
+	int		open[MAX_ZONES];			// records of the open zones, innermost last
+	int		depth = 0, overflow = 0;	// overflow: open zones past MAX_ZONES, always the innermost
+
+	void init(bool enable);				// enable needs a GL context
+	void finalize();
+	void begin_frame();
+	void end_frame();					// closes the frame and takes the results that are in
+	void begin(const char* name);		// name must outlive the timer, e.g., a literal
+	void end();
+	void reset() { for (auto& z : zones) z.count = 0; skipped = 0; }
+	int find(const char* name) const { for (int k = 0; k < int(zones.size()); k++) if (strcmp(zones[k].name, name) == 0) return k; return -1; }
+	stats_t stats(int zone, bool gpu) const;	// zeros without samples
+	void print(FILE* fp = stdout) const;
+
+protected:
+	void collect();
+};
+
+inline void pass_timer_t::init(bool enable)
+{
+	enabled = enable;
+	if (!enabled) return;
+	for (frame_t& f : frames) for (record_t& r : f.records) { glGenQueries(1, &r.begin); glGenQueries(1, &r.end); }
+	issued = read = 0;
+	reset();
+}
+
+inline void pass_timer_t::finalize()
+{
+	if (enabled) for (frame_t& f : frames) for (record_t& r : f.records) { glDeleteQueries(1, &r.begin); glDeleteQueries(1, &r.end); }
+	enabled = timing = false;
+}
+
+inline void pass_timer_t::begin_frame()
+{
+	if (!enabled) return;
+	collect();
+	timing = issued - read < FRAMES;
+	if (!timing) { skipped++; return; }
+	frames[issued % FRAMES].n = 0;
+	depth = overflow = 0;
+	begin("frame");
+}
+
+inline void pass_timer_t::end_frame()
+{
+	if (!timing) return;
+	overflow = 0;
+	while (depth) end();
+	issued++;
+	timing = false;
+	collect();
+}
+
+inline void pass_timer_t::begin(const char* name)
+{
+	if (!timing) return;
+	frame_t& f = frames[issued % FRAMES];
+	if (f.n == MAX_ZONES) { overflow++; return; }
+
+	int z = find(name);
+	if (z < 0) { zones.emplace_back(); zones.back().name = name; zones.back().depth = depth; zones.back().count = 0; z = int(zones.size()) - 1; }
+	record_t& r = f.records[f.n];
+	r.zone = z;
+	glQueryCounter(r.begin, GL_TIMESTAMP);
+	r.start = steady_t::now();
+	open[depth++] = f.n++;
+}
+
+inline void pass_timer_t::end()
+{
+	if (!timing) return;
+	if (overflow) { overflow--; return; }
+	if (!depth) return;
+	record_t& r = frames[issued % FRAMES].records[open[--depth]];
+	r.cpu = std::chrono::duration<float, std::milli>(steady_t::now() - r.start).count();
+	glQueryCounter(r.end, GL_TIMESTAMP);
+}
+
+inline void pass_timer_t::collect()
+{
+	// the frame zone ends last, so its end stands for the whole frame
+	while (read < issued)
+	{
+		frame_t& f = frames[read % FRAMES];
+		GLuint available = 0;
+		glGetQueryObjectuiv(f.records[0].end, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) break;
+		for (int k = 0; k < f.n; k++)
+		{
+			GLuint64 t0 = 0, t1 = 0;
+			glGetQueryObjectui64v(f.records[k].begin, GL_QUERY_RESULT, &t0);
+			glGetQueryObjectui64v(f.records[k].end, GL_QUERY_RESULT, &t1);
+			zone_t& z = zones[f.records[k].zone];
+			z.gpu[z.count % HISTORY] = t1 > t0 ? float((t1 - t0) / 1e6) : 0.0f;
+			z.cpu[z.count % HISTORY] = f.records[k].cpu;
+			z.count++;
+		}
+		read++;
+	}
+}
+
+inline pass_timer_t::stats_t pass_timer_t::stats(int zone, bool gpu) const
+{
+	stats_t s = { 0, 0, 0 };
+	if (zone < 0 || zone >= int(zones.size()) || !zones[zone].count) return s;
+	const zone_t& z = zones[zone];
+	uint n = min(z.count, uint(HISTORY));
+	float h[HISTORY];
+	memcpy(h, gpu ? z.gpu : z.cpu, sizeof(float) * n);
+	std::sort(h, h + n);
+	for (uint k = 0; k < n; k++) s.avg += h[k];
+	s.avg /= n;
+	s.p50 = h[(n - 1) / 2];
+	s.p99 = h[size_t((n - 1) * 0.99)];
+	return s;
+}
+
+inline void pass_timer_t::print(FILE* fp) const
+{
+	if (zones.empty() || !zones[0].count) return;
+	fprintf(fp, "pass times over the last %u frames, in ms (avg, 50th and 99th percentile; %u frames untimed):\n", min(zones[0].count, uint(HISTORY)), skipped);
+	fprintf(fp, "  %-22s %26s %26s\n", "zone", "GPU", "CPU");
+	for (int k = 0; k < int(zones.size()); k++)
+	{
+		if (!zones[k].count) continue;
+		stats_t g = stats(k, true), c = stats(k, false);
+		fprintf(fp, "  %*s%-*s %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f\n", zones[k].depth * 2, "", 22 - zones[k].depth * 2, zones[k].name, g.avg, g.p50, g.p99, c.avg, c.p50, c.p99);
+	}
+}
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef __PERF_OVERLAY_H__
+#define __PERF_OVERLAY_H__
+#pragma once
+
+#include "cgmath.h"
+#include "cgut.h"
+#include "sprite.h"
+#include "hud.h"
+#include "pass_timer.h"
+#include "profiler.h"
+
+#include <chrono>
+
+// performance overlay in the bottom-left corner: a rolling graph of frame times over
+// three lines of counters, so a stutter report can come with a screenshot of real numbers.
+// it all goes through the sprite batcher: the panel and the graph are quads of one white
+// texel in the PANEL layer (one draw), and the lines are HUD widgets in the OVERLAY layer.
+// - a bar is the interval between two frame() calls: green within the 60 Hz budget,
+//   yellow within two of them, red beyond; a line marks the budget. bars top out at MAX_MS.
+// - one line is re-rasterized every REFRESH seconds, in turn, so no frame pays for all
+//   three; counters are of the previous frame, CPU and GPU times pass_timer's averages.
+struct perf_overlay_t
+{
+	static constexpr int HISTORY = 120;			// bars in the graph
+	static constexpr float MAX_MS = 50.0f;
+	static constexpr float BUDGET_MS = 1000.0f / 60;
+	static constexpr double REFRESH = 0.1;
+	static constexpr float TEXT_SCALE = 0.4f;	// of the HUD's text height
+	static constexpr int LINE_NUM = 3;			// widgets PERF_FRAME to PERF_SCENE
+
+	typedef std::chrono::steady_clock steady_t;
+	bool	visible = false;
+	GLuint	texture = 0;				// one white texel
+	GLuint	sampler = 0;
+	float	frame_ms[HISTORY] = { 0 };
+	uint	count = 0;					// frames since init()
+	steady_t::time_point	last_frame, last_refresh;
+	int		next_line = 0;
+	ivec2	layout_size;
+
+	bool init(hud_t& hud, GLuint s);
+	void finalize();
+	void set_visible(hud_t& hud, bool b);
+	void frame();					// once per gameplay frame
+	void update(hud_t& hud, ivec2 window_size, const pass_timer_t& timer, uint obstacles, uint particles, float scale);	// before hud.update(); scale: of the scene's resolution
+	void draw(sprite_batch_t& batch, const hud_t& hud, ivec2 window_size) const;	// the panel grows to the widest line
+	float unit(ivec2 window_size) const { return window_size.y / 480.0f; }	// window pixels per layout pixel
+};
+
+inline bool perf_overlay_t::init(hud_t& hud, GLuint s)
+{
+	static const uchar white = 255;
+	sampler = s;
+	texture = render_device_t::current().create_texture(ivec2(1, 1), 1, &white, false);
+	if (!texture) { printf("%s(): unable to create the panel texture\n", __func__); return false; }
+	for (int k = 0; k < LINE_NUM; k++) hud.set_scale(hud_t::PERF_FRAME + k, TEXT_SCALE);
+	last_frame = last_refresh = steady_t::now();
+	return true;
+}
+
+inline void perf_overlay_t::finalize()
+{
+	render_device_t::current().destroy(render_device_t::TEXTURE, texture);
+	texture = 0;
+}
+
+inline void perf_overlay_t::set_visible(hud_t& hud, bool b)
+{
+	visible = b;
+	for (int k = 0; k < LINE_NUM; k++) hud.set_visible(hud_t::PERF_FRAME + k, b);
+	layout_size = ivec2(0, 0);
+}
+
+inline void perf_overlay_t::frame()
+{
+	steady_t::time_point now = steady_t::now();
+	frame_ms[count % HISTORY] = std::chrono::duration<float, std::milli>(now - last_frame).count();
+	last_frame = now;
+	count++;
+}
+
+inline void perf_overlay_t::update(hud_t& hud, ivec2 window_size, const pass_timer_t& timer, uint obstacles, uint particles, float scale)
+{
+	if (!visible) return;
+	PROFILE_ZONE("overlay");
+
+	// the lines sit in the panel, top down; anchors are window-relative
+	if (layout_size.x != window_size.x || layout_size.y != window_size.y)
+	{
+		float u = unit(window_size), line_h = hud_t::ROW_H * hud_t::TEXT_H * window_size.y * TEXT_SCALE / hud_t::GLYPH_H;
+		float y0 = window_size.y - 12.0f * u - 60.0f * u - LINE_NUM * line_h;
+		for (int k = 0; k < LINE_NUM; k++) hud.set_anchor(hud_t::PERF_FRAME + k, vec2(12.0f * u / window_size.x, (y0 + k * line_h) / window_size.y));
+		layout_size = window_size;
+	}
+
+	steady_t::time_point now = steady_t::now();
+	if (std::chrono::duration<double>(now - last_refresh).count() < REFRESH) return;
+	last_refresh = now;
+
+	char text[64];
+	const gl_state_t& gs = gl_state_t::instance();
+	if (next_line == 0)
+	{
+		uint n = min(count, uint(HISTORY / 2));
+		float avg = 0; for (uint k = 0; k < n; k++) avg += frame_ms[(count - 1 - k) % HISTORY];
+		int z = timer.find("frame");
+		if (z < 0) snprintf(text, sizeof(text), "%.1f ms", n ? avg / n : 0.0f);
+		else snprintf(text, sizeof(text), "%.1f ms  CPU %.2f  GPU %.2f", n ? avg / n : 0.0f, timer.stats(z, false).avg, timer.stats(z, true).avg);
+	}
+	else if (next_line == 1) snprintf(text, sizeof(text), "draws %u  uniforms %u  tex binds %u", gs.last[gl_state_t::DRAWS], gs.last[gl_state_t::UNIFORMS], gs.last[gl_state_t::TEXTURE_BINDS]);
+	else snprintf(text, sizeof(text), "obstacles %u  particles %u  scale %.2f", obstacles, particles, scale);
+	hud.set_text(hud_t::PERF_FRAME + next_line, text);
+	next_line = (next_line + 1) % LINE_NUM;
+}
+
+inline void perf_overlay_t::draw(sprite_batch_t& batch, const hud_t& hud, ivec2 window_size) const
+{
+	if (!visible) return;
+
+	// panel, budget line and bars in window pixels, oldest bar on the left
+	float u = unit(window_size), line_h = hud_t::ROW_H * hud_t::TEXT_H * window_size.y * TEXT_SCALE / hud_t::GLYPH_H;
+	float bar_w = 2.0f * u, graph_h = 60.0f * u;
+	vec2 g0 = vec2(12.0f * u, window_size.y - 12.0f * u);			// bottom-left of the graph
+	float text_w = 0; for (int k = 0; k < LINE_NUM; k++) text_w = max(text_w, hud.widget[hud_t::PERF_FRAME + k].pixel_width * line_h / hud_t::ROW_H);
+	vec2 p0 = vec2(8.0f * u, g0.y - graph_h - LINE_NUM * line_h - 4.0f * u), p1 = vec2(g0.x + max(HISTORY * bar_w, text_w) + 4.0f * u, g0.y + 4.0f * u);
+	auto quad = [](sprite_vertex* v, vec2 a, vec2 b, vec4 c) { v[0] = { a, vec2(0, 0), c }; v[1] = { vec2(a.x, b.y), vec2(0, 1), c }; v[2] = { b, vec2(1, 1), c }; v[3] = { vec2(b.x, a.y), vec2(1, 0), c }; };
+
+	sprite_vertex v[4 * (HISTORY + 2)];
+	uint n = 0;
+	quad(v + 4 * n++, p0, p1, vec4(0, 0, 0, 0.6f));
+	uint bars = min(count, uint(HISTORY));
+	for (uint k = 0; k < bars; k++)
+	{
+		float ms = frame_ms[(count - bars + k) % HISTORY], h = min(ms / MAX_MS, 1.0f) * graph_h, x = g0.x + (HISTORY - bars + k) * bar_w;
+		vec4 c = ms <= BUDGET_MS * 1.1f ? vec4(0.3f, 0.9f, 0.3f, 0.9f) : ms <= BUDGET_MS * 2.1f ? vec4(0.95f, 0.8f, 0.2f, 0.9f) : vec4(1.0f, 0.25f, 0.2f, 0.9f);
+		quad(v + 4 * n++, vec2(x, g0.y - h), vec2(x + bar_w * 0.75f, g0.y), c);
+	}
+	float y = g0.y - BUDGET_MS / MAX_MS * graph_h;
+	quad(v + 4 * n++, vec2(g0.x, y), vec2(g0.x + HISTORY * bar_w, y + max(u, 1.0f)), vec4(1, 1, 1, 0.5f));
+	batch.add(sprite_batch_t::PANEL, texture, sampler, v, n);
+}
+
+#endif
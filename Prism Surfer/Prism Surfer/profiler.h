@@ -0,0 +1,118 @@
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+#pragma once
+
+#include "cgmath.h"
+#include "cgut.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+
+// scoped CPU timing zones, written out as a Chrome trace (the JSON that chrome://tracing
+// and ui.perfetto.dev open). PROFILE_ZONE("name") times the rest of the enclosing scope,
+// and PROFILE_THREAD("name") names the calling thread in the trace; without PRISM_PROFILE
+// both compile to nothing, and profile_write() only says so.
+// - each thread appends to a ring of its own, EVENTS zones deep, so a zone takes no lock;
+//   the ring is made on the thread's first zone and kept to the end of the program.
+// - profile_write() takes the zones that ended in the last `seconds`. zones that other
+//   threads record meanwhile may come out torn, so write between frames.
+// - names must outlive the profiler, e.g., literals; they are written without escaping.
+#if defined(PRISM_PROFILE)
+
+struct profiler_t
+{
+	static constexpr uint EVENTS = 1 << 16;		// per thread; about 15 s of the game's zones
+
+	typedef std::chrono::steady_clock steady_t;
+	struct event_t { const char* name; int64_t begin, end; };	// ns since the epoch
+	struct thread_t { std::string name; std::atomic<uint> count; std::vector<event_t> events; };
+
+	steady_t::time_point	epoch = steady_t::now();
+	std::mutex	mutex;						// guards threads
+	std::vector<std::unique_ptr<thread_t>>	threads;	// tid: index + 1
+
+	static profiler_t& instance() { static profiler_t p; return p; }
+	int64_t now() const { return std::chrono::duration_cast<std::chrono::nanoseconds>(steady_t::now() - epoch).count(); }
+	void record(const char* name, int64_t begin, int64_t end);
+	void name_thread(const char* name) { local().name = name; }
+	bool write(const char* path, double seconds);
+
+protected:
+	thread_t& local();		// the calling thread's ring
+};
+
+struct profile_scope_t
+{
+	const char*	name;
+	int64_t		begin;
+	profile_scope_t(const char* zone) : name(zone), begin(profiler_t::instance().now()) {}
+	~profile_scope_t() { profiler_t& p = profiler_t::instance(); p.record(name, begin, p.now()); }
+};
+
+inline profiler_t::thread_t& profiler_t::local()
+{
+	thread_local thread_t* t = nullptr;
+	if (t) return *t;
+	std::lock_guard<std::mutex> lock(mutex);
+	threads.emplace_back(new thread_t());
+	t = threads.back().get();
+	t->name = "thread " + std::to_string(threads.size());
+	t->count = 0;
+	t->events.resize(EVENTS);
+	return *t;
+}
+
+inline void profiler_t::record(const char* name, int64_t begin, int64_t end)
+{
+	// only this thread writes its ring; the count publishes the event to write()
+	thread_t& t = local();
+	uint n = t.count.load(std::memory_order_relaxed);
+	t.events[n % EVENTS] = { name, begin, end };
+	t.count.store(n + 1, std::memory_order_release);
+}
+
+inline bool profiler_t::write(const char* path, double seconds)
+{
+	FILE* fp = fopen(path, "w"); if (!fp) { printf("%s(): unable to open %s\n", __func__, path); return false; }
+	int64_t cutoff = now() - int64_t(seconds * 1e9);
+	size_t zones = 0;
+	std::lock_guard<std::mutex> lock(mutex);
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	for (size_t k = 0; k < threads.size(); k++)
+	{
+		const thread_t& t = *threads[k];
+		fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"%s\"}}", k ? ",\n" : "", k + 1, t.name.c_str());
+		uint n = t.count.load(std::memory_order_acquire);
+		for (uint e = n > EVENTS ? n - EVENTS : 0; e < n; e++)
+		{
+			const event_t& z = t.events[e % EVENTS];
+			if (z.end < cutoff) continue;
+			fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f}", z.name, k + 1, z.begin / 1e3, (z.end - z.begin) / 1e3);
+			zones++;
+		}
+	}
+	fprintf(fp, "\n]}\n");
+	bool ok = !ferror(fp);
+	fclose(fp);
+	if (ok) printf("profile: %zu zones of the last %.0f s on %zu threads written to %s\n", zones, seconds, threads.size(), path);
+	else printf("%s(): failed to write %s\n", __func__, path);
+	return ok;
+}
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_ZONE(name) profile_scope_t PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+#define PROFILE_THREAD(name) profiler_t::instance().name_thread(name)
+inline bool profile_write(const char* path, double seconds) { return profiler_t::instance().write(path, seconds); }
+
+#else
+
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_THREAD(name) ((void)0)
+inline bool profile_write(const char*, double) { printf("profiling needs a build with PRISM_PROFILE defined\n"); return false; }
+
+#endif
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef __PROGRAM_CACHE_H__
+#define __PROGRAM_CACHE_H__
+#pragma once
+
+#include "cgmath.h"
+#include "cgut.h"
+
+#include <chrono>
+#include <map>
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// program cache: linked programs are kept on disk as driver binaries (glGetProgramBinary)
+// and reloaded with glProgramBinary on later runs, skipping compile and link.
+// - entries are keyed by a hash of the shader sources; the file as a whole belongs to one
+//   driver (vendor, renderer and version strings) and is dropped when that changes.
+// - with KHR/ARB_parallel_shader_compile, compiles and links run on driver threads:
+//   create() returns at once and leaves the program unused, since glUseProgram would wait
+//   for the link. anything that queries a program (a uniform location, a block index) waits
+//   too, so submit them all first and query after ready() or finish() has checked them.
+// - file layout (native endianness): magic "PSPROG01", uint32 count, uint32 reserved,
+//   uint64 driver hash, then per entry: uint64 key, uint32 format, uint32 size, the binary.
+struct program_cache_t
+{
+	struct binary_t { GLenum format; std::vector<uchar> data; };
+	struct pending_t { GLuint program, vertex_shader, fragment_shader; uint64_t key; std::chrono::steady_clock::time_point start; };
+	typedef void (APIENTRYP max_threads_proc)(GLuint count);
+
+	std::string	path;					// empty: no cache file, compile every time
+	uint64_t	driver = 0;
+	std::map<uint64_t, binary_t>	binaries;
+	std::vector<pending_t>	pending;	// compiled or linking, not checked yet
+	bool	binary_support = false, parallel = false, dirty = false;
+	uint	hits = 0, misses = 0, rejected = 0;
+	double	load_ms = 0, submit_ms = 0;	// binary loads; compile and link calls on this thread
+	double	compile_ms = 0;				// compiles in total; on driver threads, the longest span from submission until checked
+
+	void init(const char* cache_path, GLADloadproc load = nullptr);	// load: resolves the parallel compile entry point
+	GLuint create(const char* vert_source, const char* frag_source);	// 0 on a failure seen right away
+	bool ready(GLuint program);			// true once the program has linked (and was checked); false while linking or on a failure
+	bool finish();						// waits for and checks every pending program, then saves; false on a failure
+	bool save();
+
+protected:
+	static uint64_t hash(const void* data, size_t size, uint64_t h = 14695981039346656037ull) { for (size_t k = 0; k < size; k++) h = (h ^ ((const uchar*)data)[k]) * 1099511628211ull; return h; }
+	static bool has_extension(const char* name);
+	static GLuint compile(const std::string& prefix, const char* source, GLenum type);
+	bool linked(size_t k) const { GLint done = GL_TRUE; if (parallel) glGetProgramiv(pending[k].program, GL_COMPLETION_STATUS_KHR, &done); return done != GL_FALSE; }	// without waiting
+	bool complete(size_t k);			// checks pending[k] and removes it
+	bool load();
+};
+
+inline bool program_cache_t::has_extension(const char* name)
+{
+	GLint n = 0; glGetIntegerv(GL_NUM_EXTENSIONS, &n);
+	for (GLint k = 0; k < n; k++) if (const char* e = (const char*)glGetStringi(GL_EXTENSIONS, GLuint(k))) if (strcmp(e, name) == 0) return true;
+	return false;
+}
+
+inline void program_cache_t::init(const char* cache_path, GLADloadproc load_proc)
+{
+	std::string driver_name = std::string((const char*)glGetString(GL_VENDOR)) + "|" + (const char*)glGetString(GL_RENDERER) + "|" + (const char*)glGetString(GL_VERSION);
+	driver = hash(driver_name.data(), driver_name.size());
+	GLint formats = 0;
+	if (glad_glGetProgramBinary && glad_glProgramBinary) glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	binary_support = formats > 0;
+
+	// the driver decides how many threads; 0xffffffff asks for its maximum
+	max_threads_proc max_threads = nullptr;
+	if (load_proc && has_extension("GL_KHR_parallel_shader_compile")) max_threads = (max_threads_proc)load_proc("glMaxShaderCompilerThreadsKHR");
+	else if (load_proc && has_extension("GL_ARB_parallel_shader_compile")) max_threads = (max_threads_proc)load_proc("glMaxShaderCompilerThreadsARB");
+	if (max_threads) max_threads(0xffffffff);
+	parallel = max_threads != nullptr;
+
+	path = binary_support && cache_path ? cache_path : "";
+	if (!path.empty()) load();
+}
+
+inline bool program_cache_t::load()
+{
+	FILE* fp = fopen(path.c_str(), "rb");
+	if (!fp) return false;
+	char magic[8] = { 0 }; uint header[2] = { 0 }; uint64_t d = 0;
+	bool ok = fread(magic, 1, 8, fp) == 8 && memcmp(magic, "PSPROG01", 8) == 0 && fread(header, sizeof(header), 1, fp) == 1 && fread(&d, sizeof(d), 1, fp) == 1;
+	if (ok && d != driver) { fclose(fp); printf("programs: %s is from another driver; recompiling\n", path.c_str()); return false; }
+	for (uint k = 0; ok && k < header[0]; k++)
+	{
+		uint64_t key; uint e[2];
+		ok = fread(&key, sizeof(key), 1, fp) == 1 && fread(e, sizeof(e), 1, fp) == 1 && e[1] > 0;
+		if (!ok) break;
+		binary_t& b = binaries[key]; b.format = e[0]; b.data.resize(e[1]);
+		ok = fread(&b.data[0], 1, b.data.size(), fp) == b.data.size();
+	}
+	fclose(fp);
+	if (!ok) { printf("programs: %s is damaged; recompiling\n", path.c_str()); binaries.clear(); }
+	return ok;
+}
+
+inline bool program_cache_t::save()
+{
+	if (path.empty() || !dirty) return true;
+	FILE* fp = fopen(path.c_str(), "wb");
+	if (!fp) { printf("%s(): unable to create %s\n", __func__, path.c_str()); return false; }
+	uint header[2] = { uint(binaries.size()), 0 };
+	bool ok = fwrite("PSPROG01", 1, 8, fp) == 8 && fwrite(header, sizeof(header), 1, fp) == 1 && fwrite(&driver, sizeof(driver), 1, fp) == 1;
+	for (auto& b : binaries)
+	{
+		uint e[2] = { b.second.format, uint(b.second.data.size()) };
+		ok = ok && fwrite(&b.first, sizeof(b.first), 1, fp) == 1 && fwrite(e, sizeof(e), 1, fp) == 1 && fwrite(&b.second.data[0], 1, b.second.data.size(), fp) == b.second.data.size();
+	}
+	ok = fclose(fp) == 0 && ok;
+	if (!ok) { printf("%s(): unable to write %s\n", __func__, path.c_str()); remove(path.c_str()); }
+	dirty = false;
+	return ok;
+}
+
+inline GLuint program_cache_t::compile(const std::string& prefix, const char* source, GLenum type)
+{
+	// the status is not queried here, so a parallel compile keeps running
+	const char* sources[2] = { prefix.c_str(), source };
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 2, sources, nullptr);
+	glCompileShader(shader);
+	return shader;
+}
+
+inline GLuint program_cache_t::create(const char* vert_source, const char* frag_source)
+{
+	// the same #version line cg_create_shader() adds to sources without one
+	gl_version_t& v = gl_version_t::instance();
+	char version[64]; sprintf(version, "#version %d%s\n", v.glsl() * 10, v.is_gles() ? " es" : "");
+	std::string vp = strstr(vert_source, "#version") ? "" : version, fp = strstr(frag_source, "#version") ? "" : version;
+	uint64_t key = hash(frag_source, strlen(frag_source) + 1, hash(fp.data(), fp.size(), hash(vert_source, strlen(vert_source) + 1, hash(vp.data(), vp.size()))));
+	auto t0 = std::chrono::steady_clock::now();
+
+	auto it = binaries.find(key);
+	if (it != binaries.end())
+	{
+		GLuint program = glCreateProgram();
+		glProgramBinary(program, it->second.format, &it->second.data[0], GLsizei(it->second.data.size()));
+		GLint linked = 0; glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		if (linked)
+		{
+			load_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+			hits++;
+			return program;
+		}
+		glDeleteProgram(program);	// e.g., a driver update that kept the version string
+		binaries.erase(it);
+		rejected++; dirty = true;
+	}
+
+	pending_t p = { glCreateProgram(), compile(vp, vert_source, GL_VERTEX_SHADER), compile(fp, frag_source, GL_FRAGMENT_SHADER), key, t0 };
+	glAttachShader(p.program, p.vertex_shader);
+	glAttachShader(p.program, p.fragment_shader);
+	if (binary_support) glProgramParameteri(p.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(p.program);
+	pending.push_back(p);
+	misses++;
+	submit_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+	if (!parallel && !complete(pending.size() - 1)) return 0;
+	return p.program;
+}
+
+inline bool program_cache_t::complete(size_t k)
+{
+	pending_t p = pending[k];
+	pending.erase(pending.begin() + k);
+
+	// querying the status waits for the compile and link
+	bool ok = cg_validate_shader(p.vertex_shader, "vertex shader") && cg_validate_shader(p.fragment_shader, "fragment shader") && cg_validate_program(p.program, "program");
+	// a driver-thread span ends when the link was seen done; it may hold what this thread did meanwhile
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - p.start).count();
+	compile_ms = parallel ? max(compile_ms, ms) : compile_ms + ms;
+	glDeleteShader(p.vertex_shader);
+	glDeleteShader(p.fragment_shader);
+	if (!ok) { printf("Unable to link program\n"); glDeleteProgram(p.program); return false; }
+	if (path.empty()) return true;
+
+	GLint size = 0; glGetProgramiv(p.program, GL_PROGRAM_BINARY_LENGTH, &size);
+	if (size <= 0) return true;
+	binary_t& b = binaries[p.key]; b.data.resize(size_t(size));
+	glGetProgramBinary(p.program, size, nullptr, &b.format, &b.data[0]);
+	dirty = true;
+	return true;
+}
+
+inline bool program_cache_t::ready(GLuint program)
+{
+	for (size_t k = 0; k < pending.size(); k++)
+	{
+		if (pending[k].program == program) return linked(k) && complete(k);
+	}
+	return true;
+}
+
+inline bool program_cache_t::finish()
+{
+	// each program is checked once its link reports done; when none has, wait for the oldest
+	bool ok = true;
+	while (!pending.empty())
+	{
+		size_t n = pending.size();
+		for (size_t k = n; k-- > 0;) if (linked(k)) ok = complete(k) && ok;
+		if (pending.size() == n) ok = complete(0) && ok;
+	}
+	if (parallel) printf("programs: %u from the cache in %.1f ms, %u compiled on driver threads (%.1f ms to submit, all checked within %.1f ms)%s\n", hits, load_ms, misses, submit_ms, compile_ms, rejected ? " (stale binaries replaced)" : "");
+	else printf("programs: %u from the cache in %.1f ms, %u compiled in %.1f ms%s\n", hits, load_ms, misses, compile_ms, rejected ? " (stale binaries replaced)" : "");
+	return save() && ok;
+}
+
+#endif
@@ -0,0 +1,505 @@
+#ifndef __RENDER_DEVICE_H__
+#define __RENDER_DEVICE_H__
+#pragma once
+
+#include "cgmath.h"
+#include "cgut.h"
+#include "program_cache.h"
+#include <map>
+
+// one vertex attribute of an interleaved float vertex: location, components, byte offset
+struct vertex_attrib_t { GLuint index; GLint size; GLsizei offset; };
+
+// layout of cgut.h's vertex, as cg_create_vertex_array() binds it
+static const vertex_attrib_t vertex_attribs[] = { { 0, 3, GLsizei(offsetof(vertex, pos)) }, { 1, 3, GLsizei(offsetof(vertex, norm)) }, { 2, 2, GLsizei(offsetof(vertex, tex)) } };
+
+// the small slice of OpenGL the game uses: buffers, textures, samplers, programs,
+// uniforms, fixed-function state and draws. everything above it issues its
+// calls through render_device_t::current(), so the backend can be swapped:
+// - gl_device_t issues them to the current GL context (the default).
+// - null_device_t needs no context; it only counts calls and hands out names.
+// - record_device_t forwards to another device and keeps the command stream.
+// calls mirror GL closely: creation leaves the new object bound, updates act on
+// the bound object, and uniforms go to the program in use. a new program is not put
+// in use, and is queried only once it has linked (see program_cache_t).
+struct render_device_t
+{
+	enum resource_t { BUFFER, VERTEX_ARRAY, TEXTURE, SAMPLER, PROGRAM, FRAMEBUFFER, RESOURCE_NUM };
+	enum op_t {
+		CREATE_BUFFER, CREATE_VERTEX_ARRAY, CREATE_TEXTURE, CREATE_SAMPLER, CREATE_PROGRAM, DESTROY,
+		BUFFER_DATA, BUFFER_SUB_DATA, TEXTURE_SUB_IMAGE,
+		UNIFORM_LOCATION, UNIFORM_MATRIX4, UNIFORM4, UNIFORM2, UNIFORM1I,
+		USE_PROGRAM, BIND_VERTEX_ARRAY, BIND_BUFFER, ACTIVE_TEXTURE, BIND_TEXTURE, BIND_SAMPLER,
+		ENABLE, DEPTH_MASK, BLEND_FUNC, PIXEL_STORE, VIEWPORT, CLEAR_COLOR, CLEAR,
+		DRAW_ELEMENTS, DRAW_ARRAYS, FINISH,
+		CREATE_RENDER_TARGET, BIND_FRAMEBUFFER, CREATE_TEXTURE_LEVELS,
+		CREATE_TEXTURE_ARRAY, TEXTURE_LAYER, BIND_TEXTURE_ARRAY,
+		BIND_BUFFER_BASE, UNIFORM_BLOCK_BINDING, DRAW_ELEMENTS_BASE_VERTEX, OP_NUM };	// append only: op numbers are stored in traces
+	static const char* op_name(int op);
+
+	static render_device_t& current() { return *slot(); }
+	static void select(render_device_t* d);		// nullptr selects the GL device
+	static ivec2 level_size(ivec2 size, int level) { return ivec2(max(size.x >> level, 1), max(size.y >> level, 1)); }
+	static size_t texture_bytes(ivec2 size, int channels, int levels);	// levels back to back, rows 4-byte aligned
+	static int level_count(ivec2 size) { int n = 1; while (size.x >> n || size.y >> n) n++; return n; }	// the full chain down to 1x1
+
+	virtual ~render_device_t() {}
+	virtual const char* name() const = 0;
+	virtual void end_frame() {}
+
+	// resources
+	virtual GLuint create_buffer(GLenum target, size_t size, const void* data, GLenum usage) = 0;
+	virtual GLuint create_vertex_array(GLuint vertex_buffer, GLuint index_buffer, const vertex_attrib_t* attribs, int count, GLsizei stride) = 0;
+	virtual GLuint create_texture(ivec2 size, int channels, const void* data, bool mipmap) = 0;	// rows 4-byte aligned; 1 channel is white with alpha
+	virtual GLuint create_texture_levels(ivec2 size, int channels, int levels, const void* data) = 0;	// immutable, with the given mip levels
+	virtual GLuint create_texture_array(ivec2 size, int levels, int layers) = 0;	// RGBA8 layers of one size; contents come from texture_layer()
+	virtual GLuint create_sampler(GLenum min_filter, GLenum mag_filter, GLenum wrap) = 0;
+	virtual GLuint create_program(const char* vert_source, const char* frag_source) = 0;
+	virtual GLuint create_render_target(ivec2 size, bool depth, GLuint& color) = 0;	// framebuffer with an RGBA8 color texture and optional depth
+	virtual void destroy(resource_t type, GLuint id) = 0;	// a framebuffer takes its attachments along
+	virtual void buffer_data(GLenum target, size_t size, const void* data, GLenum usage) = 0;
+	virtual void buffer_sub_data(GLenum target, size_t offset, size_t size, const void* data) = 0;
+	virtual void texture_sub_image(ivec2 offset, ivec2 size, int channels, const void* data) = 0;
+	virtual void texture_layer(int layer, ivec2 size, int levels, const void* data) = 0;	// all levels of one layer of the bound array, laid out as create_texture_levels() takes them
+
+	// uniforms
+	virtual GLint uniform_location(GLuint program, const char* name) = 0;
+	virtual void uniform_matrix4(GLint loc, const mat4& m) = 0;	// row-major, as cgmath.h stores it
+	virtual void uniform4(GLint loc, const vec4& v) = 0;
+	virtual void uniform2(GLint loc, const vec2& v) = 0;
+	virtual void uniform1i(GLint loc, int i) = 0;
+	virtual void uniform_block_binding(GLuint program, const char* name, GLuint binding) = 0;	// a block the program lacks is ignored
+
+	// state and draws
+	virtual void use_program(GLuint program) = 0;
+	virtual void bind_vertex_array(GLuint vertex_array) = 0;
+	virtual void bind_buffer(GLenum target, GLuint buffer) = 0;
+	virtual void bind_buffer_base(GLenum target, GLuint index, GLuint buffer) = 0;	// indexed binding point (e.g., of uniform blocks); also binds target
+	virtual void active_texture(GLuint unit) = 0;
+	virtual void bind_texture(GLuint texture) = 0;
+	virtual void bind_texture_array(GLuint texture) = 0;	// its own binding point on the unit, beside the 2D texture
+	virtual void bind_sampler(GLuint unit, GLuint sampler) = 0;
+	virtual void bind_framebuffer(GLuint framebuffer) = 0;	// 0 is the default target (the window, or the headless one)
+	virtual void enable(GLenum cap, bool b) = 0;
+	virtual void depth_mask(bool b) = 0;
+	virtual void blend_func(GLenum src, GLenum dst) = 0;
+	virtual void pixel_store(GLenum pname, GLint value) = 0;
+	virtual void viewport(ivec2 origin, ivec2 size) = 0;
+	virtual void clear_color(const vec4& c) = 0;
+	virtual void clear(GLbitfield mask) = 0;
+	virtual void draw_elements(GLenum mode, GLsizei count, GLenum type, size_t offset) = 0;
+	virtual void draw_elements_base_vertex(GLenum mode, GLsizei count, GLenum type, size_t offset, GLint base_vertex) = 0;	// base_vertex is added to every index
+	virtual void draw_arrays(GLenum mode, GLint first, GLsizei count) = 0;
+	virtual void finish() = 0;
+
+protected:
+	static render_device_t*& slot();
+};
+
+inline size_t render_device_t::texture_bytes(ivec2 size, int channels, int levels)
+{
+	size_t n = 0;
+	for (int k = 0; k < levels; k++) { ivec2 s = level_size(size, k); n += ((size_t(s.x) * channels + 3) & ~size_t(3)) * s.y; }
+	return n;
+}
+
+inline const char* render_device_t::op_name(int op)
+{
+	static const char* names[OP_NUM] = {
+		"create_buffer", "create_vertex_array", "create_texture", "create_sampler", "create_program", "destroy",
+		"buffer_data", "buffer_sub_data", "texture_sub_image",
+		"uniform_location", "uniform_matrix4", "uniform4", "uniform2", "uniform1i",
+		"use_program", "bind_vertex_array", "bind_buffer", "active_texture", "bind_texture", "bind_sampler",
+		"enable", "depth_mask", "blend_func", "pixel_store", "viewport", "clear_color", "clear",
+		"draw_elements", "draw_arrays", "finish",
+		"create_render_target", "bind_framebuffer", "create_texture_levels",
+		"create_texture_array", "texture_layer", "bind_texture_array",
+		"bind_buffer_base", "uniform_block_binding", "draw_elements_base_vertex" };
+	return op >= 0 && op < OP_NUM ? names[op] : "?";
+}
+
+//*************************************
+// GL backend
+struct gl_device_t : public render_device_t
+{
+	GLuint	default_framebuffer = 0;			// what framebuffer 0 stands for
+	program_cache_t	programs;					// compiles, or loads cached binaries after programs.init()
+	std::map<GLuint, std::pair<GLuint, GLuint>>	attachments;	// render target -> (color texture, depth renderbuffer)
+
+	static gl_device_t& instance() { static gl_device_t d; return d; }
+	const char* name() const override { return "gl"; }
+
+	GLuint create_buffer(GLenum target, size_t size, const void* data, GLenum usage) override;
+	GLuint create_vertex_array(GLuint vertex_buffer, GLuint index_buffer, const vertex_attrib_t* attribs, int count, GLsizei stride) override;
+	GLuint create_texture(ivec2 size, int channels, const void* data, bool mipmap) override;
+	GLuint create_texture_levels(ivec2 size, int channels, int levels, const void* data) override;
+	GLuint create_texture_array(ivec2 size, int levels, int layers) override;
+	GLuint create_sampler(GLenum min_filter, GLenum mag_filter, GLenum wrap) override;
+	GLuint create_program(const char* vert_source, const char* frag_source) override { return programs.create(vert_source, frag_source); }
+	GLuint create_render_target(ivec2 size, bool depth, GLuint& color) override;
+	void destroy(resource_t type, GLuint id) override;
+	void buffer_data(GLenum target, size_t size, const void* data, GLenum usage) override { glBufferData(target, GLsizeiptr(size), data, usage); }
+	void buffer_sub_data(GLenum target, size_t offset, size_t size, const void* data) override { glBufferSubData(target, GLintptr(offset), GLsizeiptr(size), data); }
+	void texture_sub_image(ivec2 offset, ivec2 size, int channels, const void* data) override { glTexSubImage2D(GL_TEXTURE_2D, 0, offset.x, offset.y, size.x, size.y, format(channels), GL_UNSIGNED_BYTE, data); }
+	void texture_layer(int layer, ivec2 size, int levels, const void* data) override;
+
+	GLint uniform_location(GLuint program, const char* name) override { return glGetUniformLocation(program, name); }
+	void uniform_matrix4(GLint loc, const mat4& m) override { glUniformMatrix4fv(loc, 1, GL_TRUE, m); }
+	void uniform4(GLint loc, const vec4& v) override { glUniform4fv(loc, 1, &v.x); }
+	void uniform2(GLint loc, const vec2& v) override { glUniform2f(loc, v.x, v.y); }
+	void uniform1i(GLint loc, int i) override { glUniform1i(loc, i); }
+	void uniform_block_binding(GLuint program, const char* name, GLuint binding) override { GLuint k = glGetUniformBlockIndex(program, name); if (k != GL_INVALID_INDEX) glUniformBlockBinding(program, k, binding); }
+
+	void use_program(GLuint program) override { glUseProgram(program); }
+	void bind_vertex_array(GLuint vertex_array) override { glBindVertexArray(vertex_array); }
+	void bind_buffer(GLenum target, GLuint buffer) override { glBindBuffer(target, buffer); }
+	void bind_buffer_base(GLenum target, GLuint index, GLuint buffer) override { glBindBufferBase(target, index, buffer); }
+	void active_texture(GLuint unit) override { glActiveTexture(GL_TEXTURE0 + unit); }
+	void bind_texture(GLuint texture) override { glBindTexture(GL_TEXTURE_2D, texture); }
+	void bind_texture_array(GLuint texture) override { glBindTexture(GL_TEXTURE_2D_ARRAY, texture); }
+	void bind_sampler(GLuint unit, GLuint sampler) override { glBindSampler(unit, sampler); }
+	void bind_framebuffer(GLuint framebuffer) override { glBindFramebuffer(GL_FRAMEBUFFER, framebuffer ? framebuffer : default_framebuffer); }
+	void enable(GLenum cap, bool b) override { if (b) glEnable(cap); else glDisable(cap); }
+	void depth_mask(bool b) override { glDepthMask(b ? GL_TRUE : GL_FALSE); }
+	void blend_func(GLenum src, GLenum dst) override { glBlendFunc(src, dst); }
+	void pixel_store(GLenum pname, GLint value) override { glPixelStorei(pname, value); }
+	void viewport(ivec2 origin, ivec2 size) override { glViewport(origin.x, origin.y, size.x, size.y); }
+	void clear_color(const vec4& c) override { glClearColor(c.r, c.g, c.b, c.a); }
+	void clear(GLbitfield mask) override { glClear(mask); }
+	void draw_elements(GLenum mode, GLsizei count, GLenum type, size_t offset) override { glDrawElements(mode, count, type, (const GLvoid*)offset); }
+	void draw_elements_base_vertex(GLenum mode, GLsizei count, GLenum type, size_t offset, GLint base_vertex) override { glDrawElementsBaseVertex(mode, count, type, (const GLvoid*)offset, base_vertex); }
+	void draw_arrays(GLenum mode, GLint first, GLsizei count) override { glDrawArrays(mode, first, count); }
+	void finish() override { glFinish(); }
+
+	static GLenum format(int channels) { static const GLenum f[4] = { GL_RED, GL_RG, GL_RGB, GL_RGBA }; return f[clamp(channels, 1, 4) - 1]; }
+	static GLenum internal_format(int channels) { static const GLenum f[4] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 }; return f[clamp(channels, 1, 4) - 1]; }
+};
+
+inline GLuint gl_device_t::create_buffer(GLenum target, size_t size, const void* data, GLenum usage)
+{
+	GLuint b; glGenBuffers(1, &b);
+	glBindBuffer(target, b);
+	glBufferData(target, GLsizeiptr(size), data, usage);
+	return b;
+}
+
+inline GLuint gl_device_t::create_vertex_array(GLuint vertex_buffer, GLuint index_buffer, const vertex_attrib_t* attribs, int count, GLsizei stride)
+{
+	if (!vertex_buffer) { printf("%s(): vertex_buffer == 0\n", __func__); return 0; }
+
+	GLuint vao; glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+	if (index_buffer) glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+	for (int k = 0; k < count; k++)
+	{
+		glEnableVertexAttribArray(attribs[k].index);
+		glVertexAttribPointer(attribs[k].index, attribs[k].size, GL_FLOAT, GL_FALSE, stride, (GLvoid*)size_t(attribs[k].offset));
+	}
+	glBindVertexArray(0);
+	return vao;
+}
+
+inline GLuint gl_device_t::create_texture(ivec2 size, int channels, const void* data, bool mipmap)
+{
+	GLuint t; glGenTextures(1, &t);
+	glBindTexture(GL_TEXTURE_2D, t);
+	glTexImage2D(GL_TEXTURE_2D, 0, internal_format(channels), size.x, size.y, 0, format(channels), GL_UNSIGNED_BYTE, data);
+	if (channels == 1) { GLint swizzle[4] = { GL_ONE, GL_ONE, GL_ONE, GL_RED }; glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle); }
+	if (mipmap) glGenerateMipmap(GL_TEXTURE_2D);
+	else glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	return t;
+}
+
+inline GLuint gl_device_t::create_texture_levels(ivec2 size, int channels, int levels, const void* data)
+{
+	// immutable storage (GL 4.2) is allocated once for all levels; older contexts specify them one by one
+	GLuint t; glGenTextures(1, &t);
+	glBindTexture(GL_TEXTURE_2D, t);
+	bool storage = GLAD_GL_VERSION_4_2 != 0;
+	if (storage) glTexStorage2D(GL_TEXTURE_2D, levels, internal_format(channels), size.x, size.y);
+	const uchar* p = (const uchar*)data;
+	for (int k = 0; k < levels; k++)
+	{
+		ivec2 s = level_size(size, k);
+		if (storage) glTexSubImage2D(GL_TEXTURE_2D, k, 0, 0, s.x, s.y, format(channels), GL_UNSIGNED_BYTE, p);
+		else glTexImage2D(GL_TEXTURE_2D, k, internal_format(channels), s.x, s.y, 0, format(channels), GL_UNSIGNED_BYTE, p);
+		p += texture_bytes(s, channels, 1);
+	}
+	if (!storage) glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	if (channels == 1) { GLint swizzle[4] = { GL_ONE, GL_ONE, GL_ONE, GL_RED }; glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle); }
+	return t;
+}
+
+inline GLuint gl_device_t::create_texture_array(ivec2 size, int levels, int layers)
+{
+	GLuint t; glGenTextures(1, &t);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, t);
+	if (GLAD_GL_VERSION_4_2) { glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GL_RGBA8, size.x, size.y, layers); return t; }
+	for (int k = 0; k < levels; k++) { ivec2 s = level_size(size, k); glTexImage3D(GL_TEXTURE_2D_ARRAY, k, GL_RGBA8, s.x, s.y, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr); }
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	return t;
+}
+
+inline void gl_device_t::texture_layer(int layer, ivec2 size, int levels, const void* data)
+{
+	const uchar* p = (const uchar*)data;
+	for (int k = 0; k < levels; k++)
+	{
+		ivec2 s = level_size(size, k);
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, k, 0, 0, layer, s.x, s.y, 1, GL_RGBA, GL_UNSIGNED_BYTE, p);
+		p += texture_bytes(s, 4, 1);
+	}
+}
+
+inline GLuint gl_device_t::create_sampler(GLenum min_filter, GLenum mag_filter, GLenum wrap)
+{
+	GLuint s; glGenSamplers(1, &s);
+	glSamplerParameteri(s, GL_TEXTURE_MIN_FILTER, min_filter);
+	glSamplerParameteri(s, GL_TEXTURE_MAG_FILTER, mag_filter);
+	glSamplerParameteri(s, GL_TEXTURE_WRAP_S, wrap);
+	glSamplerParameteri(s, GL_TEXTURE_WRAP_T, wrap);
+	return s;
+}
+
+inline GLuint gl_device_t::create_render_target(ivec2 size, bool depth, GLuint& color)
+{
+	glGenTextures(1, &color);
+	glBindTexture(GL_TEXTURE_2D, color);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size.x, size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+	GLuint rb = 0, fbo;
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color, 0);
+	if (depth)
+	{
+		glGenRenderbuffers(1, &rb);
+		glBindRenderbuffer(GL_RENDERBUFFER, rb);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size.x, size.y);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rb);
+	}
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) printf("%s(): incomplete framebuffer\n", __func__);
+	attachments[fbo] = { color, rb };
+	return fbo;
+}
+
+inline void gl_device_t::destroy(resource_t type, GLuint id)
+{
+	if (!id) return;
+	if (type == FRAMEBUFFER)
+	{
+		auto it = attachments.find(id);
+		if (it != attachments.end()) { glDeleteTextures(1, &it->second.first); if (it->second.second) glDeleteRenderbuffers(1, &it->second.second); attachments.erase(it); }
+	}
+	switch (type)
+	{
+	case BUFFER:		glDeleteBuffers(1, &id); break;
+	case VERTEX_ARRAY:	glDeleteVertexArrays(1, &id); break;
+	case TEXTURE:		glDeleteTextures(1, &id); break;
+	case SAMPLER:		glDeleteSamplers(1, &id); break;
+	case PROGRAM:		glDeleteProgram(id); break;
+	case FRAMEBUFFER:	glDeleteFramebuffers(1, &id); break;
+	default: break;
+	}
+}
+
+inline render_device_t*& render_device_t::slot() { static render_device_t* d = &gl_device_t::instance(); return d; }
+inline void render_device_t::select(render_device_t* d) { slot() = d ? d : &gl_device_t::instance(); }
+
+//*************************************
+// null backend: no context, no work; measures what the CPU side of a frame costs
+// - names are handed out per resource type from 1; every uniform exists at location 0.
+struct null_device_t : public render_device_t
+{
+	uint64_t	count[OP_NUM] = { 0 };	// calls since reset()
+	uint64_t	bytes = 0;				// buffer and texture data passed in
+	uint		frames = 0;
+	GLuint		next_name[RESOURCE_NUM] = { 0 };
+
+	const char* name() const override { return "null"; }
+	void end_frame() override { frames++; }
+	void reset() { for (auto& c : count) c = 0; bytes = 0; frames = 0; }
+	void print(FILE* fp = stdout) const;	// calls per frame, most frequent first
+
+	GLuint create_buffer(GLenum, size_t size, const void*, GLenum) override { count[CREATE_BUFFER]++; bytes += size; return ++next_name[BUFFER]; }
+	GLuint create_vertex_array(GLuint vertex_buffer, GLuint, const vertex_attrib_t*, int, GLsizei) override { count[CREATE_VERTEX_ARRAY]++; return vertex_buffer ? ++next_name[VERTEX_ARRAY] : 0; }
+	GLuint create_texture(ivec2 size, int channels, const void*, bool) override { count[CREATE_TEXTURE]++; bytes += size_t((size.x * channels + 3) & ~3) * size.y; return ++next_name[TEXTURE]; }
+	GLuint create_texture_levels(ivec2 size, int channels, int levels, const void*) override { count[CREATE_TEXTURE_LEVELS]++; bytes += texture_bytes(size, channels, levels); return ++next_name[TEXTURE]; }
+	GLuint create_texture_array(ivec2, int, int) override { count[CREATE_TEXTURE_ARRAY]++; return ++next_name[TEXTURE]; }
+	GLuint create_sampler(GLenum, GLenum, GLenum) override { count[CREATE_SAMPLER]++; return ++next_name[SAMPLER]; }
+	GLuint create_program(const char*, const char*) override { count[CREATE_PROGRAM]++; return ++next_name[PROGRAM]; }
+	GLuint create_render_target(ivec2, bool, GLuint& color) override { count[CREATE_RENDER_TARGET]++; color = ++next_name[TEXTURE]; return ++next_name[FRAMEBUFFER]; }
+	void destroy(resource_t, GLuint) override { count[DESTROY]++; }
+	void buffer_data(GLenum, size_t size, const void* data, GLenum) override { count[BUFFER_DATA]++; if (data) bytes += size; }
+	void buffer_sub_data(GLenum, size_t, size_t size, const void*) override { count[BUFFER_SUB_DATA]++; bytes += size; }
+	void texture_sub_image(ivec2, ivec2 size, int channels, const void*) override { count[TEXTURE_SUB_IMAGE]++; bytes += size_t(size.x) * size.y * channels; }
+	void texture_layer(int, ivec2 size, int levels, const void*) override { count[TEXTURE_LAYER]++; bytes += texture_bytes(size, 4, levels); }
+
+	GLint uniform_location(GLuint, const char*) override { count[UNIFORM_LOCATION]++; return 0; }
+	void uniform_matrix4(GLint, const mat4&) override { count[UNIFORM_MATRIX4]++; }
+	void uniform4(GLint, const vec4&) override { count[UNIFORM4]++; }
+	void uniform2(GLint, const vec2&) override { count[UNIFORM2]++; }
+	void uniform1i(GLint, int) override { count[UNIFORM1I]++; }
+	void uniform_block_binding(GLuint, const char*, GLuint) override { count[UNIFORM_BLOCK_BINDING]++; }
+
+	void use_program(GLuint) override { count[USE_PROGRAM]++; }
+	void bind_vertex_array(GLuint) override { count[BIND_VERTEX_ARRAY]++; }
+	void bind_buffer(GLenum, GLuint) override { count[BIND_BUFFER]++; }
+	void bind_buffer_base(GLenum, GLuint, GLuint) override { count[BIND_BUFFER_BASE]++; }
+	void active_texture(GLuint) override { count[ACTIVE_TEXTURE]++; }
+	void bind_texture(GLuint) override { count[BIND_TEXTURE]++; }
+	void bind_texture_array(GLuint) override { count[BIND_TEXTURE_ARRAY]++; }
+	void bind_sampler(GLuint, GLuint) override { count[BIND_SAMPLER]++; }
+	void bind_framebuffer(GLuint) override { count[BIND_FRAMEBUFFER]++; }
+	void enable(GLenum, bool) override { count[ENABLE]++; }
+	void depth_mask(bool) override { count[DEPTH_MASK]++; }
+	void blend_func(GLenum, GLenum) override { count[BLEND_FUNC]++; }
+	void pixel_store(GLenum, GLint) override { count[PIXEL_STORE]++; }
+	void viewport(ivec2, ivec2) override { count[VIEWPORT]++; }
+	void clear_color(const vec4&) override { count[CLEAR_COLOR]++; }
+	void clear(GLbitfield) override { count[CLEAR]++; }
+	void draw_elements(GLenum, GLsizei, GLenum, size_t) override { count[DRAW_ELEMENTS]++; }
+	void draw_elements_base_vertex(GLenum, GLsizei, GLenum, size_t, GLint) override { count[DRAW_ELEMENTS_BASE_VERTEX]++; }
+	void draw_arrays(GLenum, GLint, GLsizei) override { count[DRAW_ARRAYS]++; }
+	void finish() override { count[FINISH]++; }
+};
+
+inline void null_device_t::print(FILE* fp) const
+{
+	int order[OP_NUM]; for (int k = 0; k < OP_NUM; k++) order[k] = k;
+	std::stable_sort(order, order + OP_NUM, [this](int a, int b) { return count[a] > count[b]; });
+	double n = frames ? double(frames) : 1.0;
+	fprintf(fp, "device calls per frame over %u frames (%.1f KB of data in total):\n", frames, bytes / 1024.0);
+	for (int k : order) if (count[k]) fprintf(fp, "  %-20s %10.2f\n", op_name(k), count[k] / n);
+}
+
+//*************************************
+// recording backend: forwards every call to another device and appends it to a
+// command stream, with the data it points to copied into a payload buffer.
+// - names in the stream are the ones that device returned.
+// - end_frame() marks frame boundaries; frame k spans [frame_start[k], frame_start[k+1]).
+struct record_device_t : public render_device_t
+{
+	struct command_t { uint op; uint arg[5]; uint64_t data, size; };	// payload range in bytes
+
+	render_device_t&	device;		// the device that executes the calls
+	std::vector<command_t>	commands;
+	std::vector<uchar>		payload;
+	std::vector<size_t>		frame_start = { 0 };	// the first "frame" holds initialization
+	GLint	unpack_alignment = 4;
+	bool	enabled = true;		// false: forward without recording
+
+	record_device_t(render_device_t& d) : device(d) {}
+	const char* name() const override { return "record"; }
+	void end_frame() override { device.end_frame(); frame_start.push_back(commands.size()); }
+	uint frames() const { return uint(frame_start.size() - 1); }
+	void clear() { commands.clear(); payload.clear(); frame_start.assign(1, 0); }
+	void dump(FILE* fp, uint frame) const;		// frame 0 is initialization
+
+	GLuint create_buffer(GLenum target, size_t size, const void* data, GLenum usage) override { GLuint b = device.create_buffer(target, size, data, usage); push(CREATE_BUFFER, { b, target, usage, uint(size) }, data, data ? size : 0); return b; }
+	GLuint create_vertex_array(GLuint vertex_buffer, GLuint index_buffer, const vertex_attrib_t* attribs, int count, GLsizei stride) override;
+	GLuint create_texture(ivec2 size, int channels, const void* data, bool mipmap) override;
+	GLuint create_texture_levels(ivec2 size, int channels, int levels, const void* data) override { GLuint t = device.create_texture_levels(size, channels, levels, data); push(CREATE_TEXTURE_LEVELS, { t, uint(size.x), uint(size.y), uint(channels), uint(levels) }, data, texture_bytes(size, channels, levels)); return t; }
+	GLuint create_texture_array(ivec2 size, int levels, int layers) override { GLuint t = device.create_texture_array(size, levels, layers); push(CREATE_TEXTURE_ARRAY, { t, uint(size.x), uint(size.y), uint(levels), uint(layers) }); return t; }
+	GLuint create_sampler(GLenum min_filter, GLenum mag_filter, GLenum wrap) override { GLuint s = device.create_sampler(min_filter, mag_filter, wrap); push(CREATE_SAMPLER, { s, min_filter, mag_filter, wrap }); return s; }
+	GLuint create_program(const char* vert_source, const char* frag_source) override;
+	GLuint create_render_target(ivec2 size, bool depth, GLuint& color) override { GLuint f = device.create_render_target(size, depth, color); push(CREATE_RENDER_TARGET, { f, uint(size.x), uint(size.y), uint(depth), color }); return f; }
+	void destroy(resource_t type, GLuint id) override { device.destroy(type, id); push(DESTROY, { uint(type), id }); }
+	void buffer_data(GLenum target, size_t size, const void* data, GLenum usage) override { device.buffer_data(target, size, data, usage); push(BUFFER_DATA, { target, uint(size), usage }, data, data ? size : 0); }
+	void buffer_sub_data(GLenum target, size_t offset, size_t size, const void* data) override { device.buffer_sub_data(target, offset, size, data); push(BUFFER_SUB_DATA, { target, uint(offset) }, data, size); }
+	void texture_sub_image(ivec2 offset, ivec2 size, int channels, const void* data) override;
+	void texture_layer(int layer, ivec2 size, int levels, const void* data) override { device.texture_layer(layer, size, levels, data); push(TEXTURE_LAYER, { uint(layer), uint(size.x), uint(size.y), uint(levels) }, data, texture_bytes(size, 4, levels)); }
+
+	GLint uniform_location(GLuint program, const char* name) override { GLint loc = device.uniform_location(program, name); push(UNIFORM_LOCATION, { uint(loc), program }, name, strlen(name) + 1); return loc; }
+	void uniform_matrix4(GLint loc, const mat4& m) override { device.uniform_matrix4(loc, m); push(UNIFORM_MATRIX4, { uint(loc) }, &m, sizeof(m)); }
+	void uniform4(GLint loc, const vec4& v) override { device.uniform4(loc, v); push(UNIFORM4, { uint(loc) }, &v, sizeof(v)); }
+	void uniform2(GLint loc, const vec2& v) override { device.uniform2(loc, v); push(UNIFORM2, { uint(loc) }, &v, sizeof(v)); }
+	void uniform1i(GLint loc, int i) override { device.uniform1i(loc, i); push(UNIFORM1I, { uint(loc), uint(i) }); }
+	void uniform_block_binding(GLuint program, const char* name, GLuint binding) override { device.uniform_block_binding(program, name, binding); push(UNIFORM_BLOCK_BINDING, { program, binding }, name, strlen(name) + 1); }
+
+	void use_program(GLuint program) override { device.use_program(program); push(USE_PROGRAM, { program }); }
+	void bind_vertex_array(GLuint vertex_array) override { device.bind_vertex_array(vertex_array); push(BIND_VERTEX_ARRAY, { vertex_array }); }
+	void bind_buffer(GLenum target, GLuint buffer) override { device.bind_buffer(target, buffer); push(BIND_BUFFER, { target, buffer }); }
+	void bind_buffer_base(GLenum target, GLuint index, GLuint buffer) override { device.bind_buffer_base(target, index, buffer); push(BIND_BUFFER_BASE, { target, index, buffer }); }
+	void active_texture(GLuint unit) override { device.active_texture(unit); push(ACTIVE_TEXTURE, { unit }); }
+	void bind_texture(GLuint texture) override { device.bind_texture(texture); push(BIND_TEXTURE, { texture }); }
+	void bind_texture_array(GLuint texture) override { device.bind_texture_array(texture); push(BIND_TEXTURE_ARRAY, { texture }); }
+	void bind_sampler(GLuint unit, GLuint sampler) override { device.bind_sampler(unit, sampler); push(BIND_SAMPLER, { unit, sampler }); }
+	void bind_framebuffer(GLuint framebuffer) override { device.bind_framebuffer(framebuffer); push(BIND_FRAMEBUFFER, { framebuffer }); }
+	void enable(GLenum cap, bool b) override { device.enable(cap, b); push(ENABLE, { cap, uint(b) }); }
+	void depth_mask(bool b) override { device.depth_mask(b); push(DEPTH_MASK, { uint(b) }); }
+	void blend_func(GLenum src, GLenum dst) override { device.blend_func(src, dst); push(BLEND_FUNC, { src, dst }); }
+	void pixel_store(GLenum pname, GLint value) override { device.pixel_store(pname, value); if (pname == GL_UNPACK_ALIGNMENT) unpack_alignment = value; push(PIXEL_STORE, { pname, uint(value) }); }
+	void viewport(ivec2 origin, ivec2 size) override { device.viewport(origin, size); push(VIEWPORT, { uint(origin.x), uint(origin.y), uint(size.x), uint(size.y) }); }
+	void clear_color(const vec4& c) override { device.clear_color(c); push(CLEAR_COLOR, {}, &c, sizeof(c)); }
+	void clear(GLbitfield mask) override { device.clear(mask); push(CLEAR, { mask }); }
+	void draw_elements(GLenum mode, GLsizei count, GLenum type, size_t offset) override { device.draw_elements(mode, count, type, offset); push(DRAW_ELEMENTS, { mode, uint(count), type, uint(offset) }); }
+	void draw_elements_base_vertex(GLenum mode, GLsizei count, GLenum type, size_t offset, GLint base_vertex) override { device.draw_elements_base_vertex(mode, count, type, offset, base_vertex); push(DRAW_ELEMENTS_BASE_VERTEX, { mode, uint(count), type, uint(offset), uint(base_vertex) }); }
+	void draw_arrays(GLenum mode, GLint first, GLsizei count) override { device.draw_arrays(mode, first, count); push(DRAW_ARRAYS, { mode, uint(first), uint(count) }); }
+	void finish() override { device.finish(); push(FINISH, {}); }
+
+protected:
+	void push(op_t op, std::initializer_list<uint> args, const void* data = nullptr, size_t size = 0);
+};
+
+inline void record_device_t::push(op_t op, std::initializer_list<uint> args, const void* data, size_t size)
+{
+	if (!enabled) return;
+	command_t c = { uint(op), { 0 }, payload.size(), size };
+	uint k = 0; for (uint a : args) if (k < 5) c.arg[k++] = a;
+	if (size) payload.insert(payload.end(), (const uchar*)data, (const uchar*)data + size);
+	commands.push_back(c);
+}
+
+inline GLuint record_device_t::create_vertex_array(GLuint vertex_buffer, GLuint index_buffer, const vertex_attrib_t* attribs, int count, GLsizei stride)
+{
+	GLuint vao = device.create_vertex_array(vertex_buffer, index_buffer, attribs, count, stride);
+	push(CREATE_VERTEX_ARRAY, { vao, vertex_buffer, index_buffer, uint(count), uint(stride) }, attribs, sizeof(vertex_attrib_t) * count);
+	return vao;
+}
+
+inline GLuint record_device_t::create_texture(ivec2 size, int channels, const void* data, bool mipmap)
+{
+	GLuint t = device.create_texture(size, channels, data, mipmap);
+	push(CREATE_TEXTURE, { t, uint(size.x), uint(size.y), uint(channels), uint(mipmap) }, data, data ? size_t((size.x * channels + 3) & ~3) * size.y : 0);
+	return t;
+}
+
+inline GLuint record_device_t::create_program(const char* vert_source, const char* frag_source)
+{
+	// both sources go into the payload, each with its terminator
+	GLuint p = device.create_program(vert_source, frag_source);
+	size_t nv = strlen(vert_source) + 1, nf = strlen(frag_source) + 1;
+	std::string sources = std::string(vert_source, nv) + std::string(frag_source, nf);
+	push(CREATE_PROGRAM, { p, uint(nv) }, sources.data(), sources.size());
+	return p;
+}
+
+inline void record_device_t::texture_sub_image(ivec2 offset, ivec2 size, int channels, const void* data)
+{
+	device.texture_sub_image(offset, size, channels, data);
+	size_t row = size_t(size.x) * channels, a = size_t(unpack_alignment);
+	push(TEXTURE_SUB_IMAGE, { uint(offset.x), uint(offset.y), uint(size.x), uint(size.y), uint(channels) }, data, ((row + a - 1) / a * a) * (size.y - 1) + row);
+}
+
+inline void record_device_t::dump(FILE* fp, uint frame) const
+{
+	if (frame >= frame_start.size()) return;
+	size_t first = frame_start[frame], last = frame + 1 < frame_start.size() ? frame_start[frame + 1] : commands.size();
+	for (size_t k = first; k < last; k++)
+	{
+		const command_t& c = commands[k];
+		fprintf(fp, "%-20s %u %u %u %u %u", op_name(int(c.op)), c.arg[0], c.arg[1], c.arg[2], c.arg[3], c.arg[4]);
+		const float* f = (const float*)(payload.data() + c.data);
+		if (c.op == UNIFORM_LOCATION || c.op == UNIFORM_BLOCK_BINDING) fprintf(fp, " \"%s\"", (const char*)(payload.data() + c.data));
+		else if (c.op == UNIFORM4 || c.op == CLEAR_COLOR) fprintf(fp, " (%g %g %g %g)", f[0], f[1], f[2], f[3]);
+		else if (c.op == UNIFORM2) fprintf(fp, " (%g %g)", f[0], f[1]);
+		else if (c.op == UNIFORM_MATRIX4) fprintf(fp, " (%g %g %g %g ...)", f[0], f[1], f[2], f[3]);
+		else if (c.size) fprintf(fp, " [%zu bytes]", size_t(c.size));
+		fputc('\n', fp);
+	}
+}
+
+#endif
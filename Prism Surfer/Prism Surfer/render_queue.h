@@ -0,0 +1,135 @@
+#ifndef __RENDER_QUEUE_H__
+#define __RENDER_QUEUE_H__
+#pragma once
+
+#include "cgmath.h"
+#include "cgut.h"
+#include "glstate.h"
+
+// one draw submission; the model matrix is uploaded right before the draw
+struct draw_item_t
+{
+	GLuint	program = 0;
+	GLuint	texture = 0;
+	int		layer = -1;			// slice of texture when it is an array texture, -1 for a 2D texture
+	GLuint	sampler = 0;
+	GLuint	vertex_array = 0;
+	GLenum	mode = GL_TRIANGLES;
+	GLuint	first = 0;			// first index, or first vertex when not indexed
+	GLsizei	count = 0;			// index count, or vertex count when not indexed
+	GLint	base_vertex = 0;	// added to each index
+	bool	indexed = true;
+	bool	use_color = false;
+	vec4	color;
+	mat4	model_matrix;
+};
+
+// sort-keyed render queue with an opaque and a transparent pass.
+// 64-bit keys, from the most significant bit:
+// - opaque:      pass(2) program(6) texture(12) mesh(12) unused(8) depth(24)  -> state-grouped, front-to-back
+// - transparent: pass(2) far-depth(24) program(6) texture(12) mesh(12) unused(8) -> back-to-front
+// the texture field holds the name and the layer (4 low bits), so an array's slices group too;
+// the mesh field holds the vertex array and the first index, so shapes of one arena group too.
+struct render_queue_t
+{
+	enum pass_t { OPAQUE, TRANSPARENT, PASS_NUM };
+
+	struct program_t { GLuint id; GLint model_matrix, color, layer; int layer_value; };	// layer_value: the layer uniform as last set
+	struct sort_t { uint64_t key; uint index; };
+
+	float	dfar = 1000.0f;		// depth range used for key quantization
+	std::vector<program_t>	programs;	// registered programs with cached uniform locations
+	std::vector<draw_item_t>	items;
+	std::vector<sort_t>		keys[PASS_NUM];
+	std::vector<sort_t>		scratch;
+
+	void register_program(GLuint program);	// once it has linked; looks up its uniforms
+	void clear() { items.clear(); for (auto& k : keys) k.clear(); for (auto& p : programs) p.layer_value = -1; }
+	void submit(int pass, const draw_item_t& item, float depth);
+	void sort();
+	void issue(int pass);	// the sorted items of one pass
+	void flush();	// sorts, issues and clears
+
+protected:
+	uint program_index(GLuint program) const { for (uint k = 0; k < programs.size(); k++) if (programs[k].id == program) return k; return 0; }
+	void radix_sort(std::vector<sort_t>& v);
+};
+
+inline void render_queue_t::register_program(GLuint program)
+{
+	for (auto& p : programs) if (p.id == program) return;
+	render_device_t& rd = render_device_t::current();
+	programs.push_back({ program, rd.uniform_location(program, "model_matrix"), rd.uniform_location(program, "color"), rd.uniform_location(program, "layer"), -1 });
+}
+
+inline void render_queue_t::submit(int pass, const draw_item_t& item, float depth)
+{
+	uint64_t d = uint64_t(clamp(depth / dfar, 0.0f, 1.0f) * float(0xffffff));
+	uint64_t state = (uint64_t(program_index(item.program) & 0x3f) << 24) | (uint64_t(((item.texture << 4) + uint(item.layer + 1)) & 0xfff) << 12) | uint64_t(((item.vertex_array << 8) + item.first) & 0xfff);
+	uint64_t key = uint64_t(pass) << 62;
+	if (pass == OPAQUE) key |= (state << 32) | d;
+	else key |= ((0xffffff - d) << 38) | (state << 8);
+
+	keys[pass].push_back({ key, uint(items.size()) });
+	items.push_back(item);
+}
+
+inline void render_queue_t::radix_sort(std::vector<sort_t>& v)
+{
+	// LSD radix sort on 8-bit digits; digits shared by every key are skipped
+	scratch.resize(v.size());
+	for (uint shift = 0; shift < 64; shift += 8)
+	{
+		uint count[257] = { 0 };
+		for (const sort_t& s : v) count[((s.key >> shift) & 0xff) + 1]++;
+		if (count[((v[0].key >> shift) & 0xff) + 1] == v.size()) continue;
+		for (uint k = 1; k < 257; k++) count[k] += count[k - 1];
+		for (const sort_t& s : v) scratch[count[(s.key >> shift) & 0xff]++] = s;
+		v.swap(scratch);
+	}
+}
+
+inline void render_queue_t::sort()
+{
+	if (!keys[OPAQUE].empty()) std::sort(keys[OPAQUE].begin(), keys[OPAQUE].end(), [](const sort_t& a, const sort_t& b) { return a.key < b.key; });
+	if (!keys[TRANSPARENT].empty()) radix_sort(keys[TRANSPARENT]);
+}
+
+inline void render_queue_t::issue(int pass)
+{
+	// the state cache drops binds that equal the previous item's
+	gl_state_t& gs = gl_state_t::instance();
+	if (keys[pass].empty()) return;
+	GLuint program = 0;
+	program_t* p = nullptr;
+	gs.set_depth_mask(pass == OPAQUE);	// sorted transparent items must not occlude each other
+	for (const sort_t& s : keys[pass])
+	{
+		const draw_item_t& it = items[s.index];
+		if (it.program != program) p = &programs[program_index(program = it.program)];
+		gs.use_program(it.program);
+		gs.bind_sampler(it.sampler);
+		if (it.layer < 0) gs.bind_texture(it.texture);
+		else
+		{
+			gs.bind_texture_array(it.texture);
+			if (p->layer > -1 && p->layer_value != it.layer) gs.uniform1i(p->layer, p->layer_value = it.layer);
+		}
+		gs.bind_vertex_array(it.vertex_array);
+		if (p->model_matrix > -1) gs.uniform_matrix4(p->model_matrix, it.model_matrix);
+		if (it.use_color && p->color > -1) gs.uniform4(p->color, it.color);
+
+		if (it.indexed) gs.draw_elements_base_vertex(it.mode, it.count, GL_UNSIGNED_INT, sizeof(uint) * it.first, it.base_vertex);
+		else gs.draw_arrays(it.mode, GLint(it.first), it.count);
+	}
+	gs.set_depth_mask(true);
+}
+
+inline void render_queue_t::flush()
+{
+	sort();
+	for (int pass = 0; pass < PASS_NUM; pass++) issue(pass);
+	clear();
+}
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef __SHADER_VARIANTS_H__
+#define __SHADER_VARIANTS_H__
+#pragma once
+
+#include "cgmath.h"
+#include "cgut.h"
+#include "render_device.h"
+
+// compile-time shader variants: one vertex/fragment source pair whose optional features
+// sit behind #ifdef, specialized into a program per feature set (the key, a bitmask).
+// a variant is built on its first get() and kept, so each draw picks the cheapest program
+// that has what it needs; build the known ones at startup to keep compiles off the frame.
+// - the sources must not carry a #version line; the defines go in front of them.
+struct shader_variants_t
+{
+	enum feature_t { TINT = 1 << 0, FEATURE_NUM = 1 };
+	static const char* feature_name(int k) { static const char* names[FEATURE_NUM] = { "TINT" }; return names[k]; }
+
+	const char*	vert_source = nullptr;
+	const char*	frag_source = nullptr;
+	std::vector<std::pair<uint, GLuint>>	programs;	// (key, program) in the order they were built
+
+	void init(const char* vert, const char* frag) { vert_source = vert; frag_source = frag; }
+	void finalize();
+	GLuint get(uint key);	// 0 if the variant fails to build
+};
+
+inline GLuint shader_variants_t::get(uint key)
+{
+	for (auto& p : programs) if (p.first == key) return p.second;
+
+	std::string defines;
+	for (int k = 0; k < FEATURE_NUM; k++) if (key & (1u << k)) defines += std::string("#define ") + feature_name(k) + "\n";
+	GLuint program = render_device_t::current().create_program((defines + vert_source).c_str(), (defines + frag_source).c_str());
+	if (!program) { printf("%s(): unable to build variant %u\n", __func__, key); return 0; }
+	programs.push_back({ key, program });
+	return program;
+}
+
+inline void shader_variants_t::finalize()
+{
+	for (auto& p : programs) render_device_t::current().destroy(render_device_t::PROGRAM, p.second);
+	programs.clear();
+}
+
+#endif
@@ -1,27 +1,26 @@
 #pragma once
+// scene shaders: features are compiled in by the defines of a variant (see shader_variants.h)
+// - TINT: the texel is multiplied by the color uniform, e.g., a particle's color and fade
 static const char* vert_shader = R"glsl(
 // vertex attributes
 layout(location=0) in vec3 position;
 layout(location=1) in vec3 normal;
 layout(location=2) in vec2 texcoord;
 
-// matrices
+// matrices: the camera's are shared by every scene program (see camera_block.h); the model's is per draw
+layout(std140, row_major) uniform camera
+{
+	mat4 view_matrix;
+	mat4 projection_matrix;
+	mat4 view_projection_matrix;
+};
 uniform mat4 model_matrix;
-uniform mat4 view_matrix;
-uniform mat4 projection_matrix;
 
-out vec4 epos;
-out vec3 norm;
 out vec2 tc;
 
 void main()
 {
-	vec4 wpos = model_matrix * vec4(position,1);
-	epos = view_matrix * wpos;
-	gl_Position = projection_matrix * epos;
-
-	// pass eye-coordinate normal to fragment shader
-	norm = normalize(mat3(view_matrix*model_matrix)*normal);
+	gl_Position = view_projection_matrix * (model_matrix * vec4(position,1));
 	tc = texcoord;
 }
 )glsl";
@@ -35,19 +34,64 @@ static const char* frag_shader = R"glsl(
 #endif
 
 // input from vertex shader
-in vec4 epos;
-in vec3 norm;
 in vec2 tc;
 
 // the only output variable
 out vec4 fragColor;
 
-uniform sampler2D TEX;
+// scene textures are the layers of one array
+uniform sampler2DArray TEX;
+uniform int layer;
+#ifdef TINT
+uniform vec4 color;
+#endif
 
 void main()
 {
+	fragColor = texture( TEX, vec3(tc, layer) );
+#ifdef TINT
+	fragColor *= color;
+#endif
+}
+
+)glsl";
 
-	fragColor = texture( TEX, tc );
+static const char* sprite_vert = R"glsl(
+// screen-space sprite vertex: position in window pixels (x right, y down)
+layout(location=0) in vec2 position;
+layout(location=1) in vec2 texcoord;
+layout(location=2) in vec4 color;
+
+uniform vec2 screen_size;
+
+out vec2 tc;
+out vec4 tint;
+
+void main()
+{
+	gl_Position = vec4(position.x*2.0/screen_size.x-1.0, 1.0-position.y*2.0/screen_size.y, 0, 1);
+	tc = texcoord;
+	tint = color;
 }
+)glsl";
 
+static const char* sprite_frag = R"glsl(
+#ifdef GL_ES
+	#ifndef GL_FRAGMENT_PRECISION_HIGH	// highp may not be defined
+		#define highp mediump
+	#endif
+	precision highp float; // default precision needs to be defined
+#endif
+
+in vec2 tc;
+in vec4 tint;
+
+out vec4 fragColor;
+
+uniform sampler2D TEX;
+
+void main()
+{
+	fragColor = texture( TEX, tc ) * tint;
+}
 )glsl";
@@ -0,0 +1,634 @@
+#ifndef __SOFTRAS_H__
+#define __SOFTRAS_H__
+#pragma once
+
+#include "cgmath.h"
+#include "cgut.h"
+#include "sprite.h"
+#include "render_queue.h"
+#include "profiler.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <map>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SOFTRAS_SSE2
+#endif
+
+// assume stb_image_write.h included before this header
+
+// four-lane float vector for the rasterizer's inner loop: SSE2 where available, scalar otherwise
+#ifdef SOFTRAS_SSE2
+struct float4
+{
+	__m128 v;
+	float4() {}
+	float4(__m128 m) : v(m) {}
+	float4(float f) : v(_mm_set1_ps(f)) {}
+	static float4 ramp(float f) { return _mm_setr_ps(f, f + 1, f + 2, f + 3); }
+	static float4 load(const float* p) { return _mm_loadu_ps(p); }
+	void store(float* p) const { _mm_storeu_ps(p, v); }
+	float4 operator+(const float4& b) const { return _mm_add_ps(v, b.v); }
+	float4 operator*(const float4& b) const { return _mm_mul_ps(v, b.v); }
+	float4 operator/(const float4& b) const { return _mm_div_ps(v, b.v); }
+	// comparisons return a 4-bit lane mask
+	int operator>(const float4& b) const { return _mm_movemask_ps(_mm_cmpgt_ps(v, b.v)); }
+	int operator>=(const float4& b) const { return _mm_movemask_ps(_mm_cmpge_ps(v, b.v)); }
+	int operator<(const float4& b) const { return _mm_movemask_ps(_mm_cmplt_ps(v, b.v)); }
+};
+#else
+struct float4
+{
+	float v[4];
+	float4() {}
+	float4(float f) { v[0] = v[1] = v[2] = v[3] = f; }
+	static float4 ramp(float f) { float4 r; for (int k = 0; k < 4; k++) r.v[k] = f + k; return r; }
+	static float4 load(const float* p) { float4 r; for (int k = 0; k < 4; k++) r.v[k] = p[k]; return r; }
+	void store(float* p) const { for (int k = 0; k < 4; k++) p[k] = v[k]; }
+	float4 operator+(const float4& b) const { float4 r; for (int k = 0; k < 4; k++) r.v[k] = v[k] + b.v[k]; return r; }
+	float4 operator*(const float4& b) const { float4 r; for (int k = 0; k < 4; k++) r.v[k] = v[k] * b.v[k]; return r; }
+	float4 operator/(const float4& b) const { float4 r; for (int k = 0; k < 4; k++) r.v[k] = v[k] / b.v[k]; return r; }
+	int operator>(const float4& b) const { int m = 0; for (int k = 0; k < 4; k++) m |= int(v[k] > b.v[k]) << k; return m; }
+	int operator>=(const float4& b) const { int m = 0; for (int k = 0; k < 4; k++) m |= int(v[k] >= b.v[k]) << k; return m; }
+	int operator<(const float4& b) const { int m = 0; for (int k = 0; k < 4; k++) m |= int(v[k] < b.v[k]) << k; return m; }
+};
+#endif
+
+// floorf() without SSE4.1 is a library call; this one is not
+inline int ifloor(float f) { int i = int(f); return i - int(f < float(i)); }
+#ifdef SOFTRAS_SSE2
+inline __m128i ifloor(__m128 f) { __m128i i = _mm_cvttps_epi32(f); return _mm_add_epi32(i, _mm_castps_si128(_mm_cmplt_ps(f, _mm_cvtepi32_ps(i)))); }
+#endif
+
+// RGBA8 helpers working on two channels per 32-bit lane
+inline uint rgba_lerp(uint a, uint b, uint f)	// f in [0,256]
+{
+	uint rb = ((a & 0x00ff00ff) * (256 - f) + (b & 0x00ff00ff) * f) >> 8;
+	uint ag = ((a >> 8 & 0x00ff00ff) * (256 - f) + (b >> 8 & 0x00ff00ff) * f) >> 8;
+	return (rb & 0x00ff00ff) | ((ag & 0x00ff00ff) << 8);
+}
+inline uint rgba_modulate(uint a, uint b)
+{
+	uint r = 0;
+	for (int sh = 0; sh < 32; sh += 8) r |= (((a >> sh & 0xff) * (b >> sh & 0xff) + 127) / 255) << sh;
+	return r;
+}
+
+// tile-binned software rasterizer for exactly what the game draws: indexed or
+// stripped triangles of cgut.h vertices transformed by projection*view*model,
+// one texture fetch per fragment (frag_shader) or texture*tint (sprite_frag),
+// back-face culling, depth test (GL_LESS) and SRC_ALPHA/ONE_MINUS_SRC_ALPHA blending.
+// - draws are only recorded and binned into TILE x TILE tiles; resolve() shades the
+//   tiles in parallel, each tile walking its triangles in submission order.
+// - the coverage, depth test and attribute interpolation run on four pixels at once; with
+//   SSE2 so do the bilinear fetch, tint and blend (shade4()), matching the scalar path bit for bit.
+// - GL objects are mirrored by name: textures, samplers and vertex arrays must be
+//   registered with their CPU-side data before they are drawn; an array texture's
+//   layers are registered one by one.
+// - differences from GL: one mip level per triangle, and a sprite quad is tinted by its first vertex.
+struct soft_rasterizer_t
+{
+	static constexpr int TILE = 64;
+
+	struct texture_t
+	{
+		std::vector<std::vector<uint>>	level;	// RGBA8 pyramid, level 0 first
+		std::vector<ivec2>	size;
+		uint	version = 0;
+	};
+	struct sampler_t { bool repeat = true, mipmap = true; };
+	struct mesh_t { std::vector<vertex> vertices; std::vector<uint> indices; };
+	struct state_t { const texture_t* texture; sampler_t sampler; bool depth_test, depth_write; };
+	struct triangle_t
+	{
+		float	edge[3][3];		// unnormalized edge functions (a, b, c): a*x + b*y + c >= 0 inside
+		bool	inclusive[3];	// tie-breaking for pixels exactly on an edge
+		float	inv_area;
+		float	z[3], iw[3], uw[3], vw[3];	// per-vertex depth, 1/w, u/w and v/w
+		uint	tint;			// RGBA8; sprites only
+		bool	tinted;
+		ivec2	lo, hi;			// pixel bounding box, inclusive
+		int		level;			// mip level for the whole triangle
+		uint	state;
+	};
+	struct clip_vertex { vec4 pos; vec2 tex; };
+
+	ivec2	size;
+	int		stride = 0;					// buffers are padded to whole tiles
+	ivec2	tiles;
+	std::vector<uint>	color;			// RGBA8, bottom-up like GL
+	std::vector<float>	depth;
+	uint	clear_color = 0;
+	std::vector<triangle_t>	triangles;
+	std::vector<state_t>	states;
+	std::vector<std::vector<uint>>	bins;	// triangle indices per tile
+
+	std::map<uint64_t, texture_t>	textures;	// by texture_key()
+	std::map<GLuint, sampler_t>	samplers;
+	std::map<GLuint, mesh_t>	meshes;
+
+	std::vector<std::thread>	threads;
+	std::mutex	mutex;
+	std::condition_variable	wake, done;
+	uint	generation = 0;
+	int		busy = 0;
+	bool	quit = false;
+	std::atomic<int>	next_tile{ 0 };
+
+	bool init(int thread_count = 0);	// 0: one thread per core
+	void finalize();
+
+	void register_texture(GLuint id, int width, int height, int channels, const uchar* data, uint version = 0) { load_texture(textures[texture_key(id, -1)], width, height, channels, data, version); }
+	void register_texture_layer(GLuint id, int layer, int width, int height, int channels, const uchar* data) { load_texture(textures[texture_key(id, layer)], width, height, channels, data, 0); }
+	void register_sampler(GLuint id, bool repeat, bool mipmap) { samplers[id] = { repeat, mipmap }; }
+	void register_mesh(GLuint vertex_array, const vertex* v, size_t vertex_count, const uint* i = nullptr, size_t index_count = 0);
+	bool has_texture(GLuint id, uint version) const { auto it = textures.find(texture_key(id, -1)); return it != textures.end() && it->second.version == version; }
+
+	void begin(ivec2 frame_size, vec4 clear);
+	void draw(const draw_item_t& item, const mat4& view_projection, bool depth_write);
+	void draw(const render_queue_t& queue, const mat4& view_projection);	// items in the queue's sorted order
+	void draw(const sprite_batch_t& batch, int layer);
+	void resolve();
+	bool write(const char* path) const;
+
+protected:
+	static uint64_t texture_key(GLuint id, int layer) { return uint64_t(id) | (uint64_t(layer + 1) << 32); }
+	static void load_texture(texture_t& t, int width, int height, int channels, const uchar* data, uint version);
+	uint add_state(GLuint texture, int layer, GLuint sampler, bool depth_test, bool depth_write);
+	void add_triangle(const clip_vertex& a, const clip_vertex& b, const clip_vertex& c, uint state, vec4 tint);
+	void setup(const vec3 p[3], const vec2 t[3], const float w[3], uint state, vec4 tint);
+	void run();
+	void work();
+	void shade_tile(int tile);
+	static uint sample(const uint* texels, ivec2 size, bool repeat, float u, float v);
+#ifdef SOFTRAS_SSE2
+	static void shade4(uint* dst, int mask, const uint* texels, ivec2 size, bool repeat, float4 u, float4 v, bool tinted, uint tint);
+#endif
+};
+
+inline bool soft_rasterizer_t::init(int thread_count)
+{
+	if (thread_count <= 0) thread_count = int(std::thread::hardware_concurrency());
+	for (int k = 1; k < thread_count; k++) threads.emplace_back(&soft_rasterizer_t::run, this);	// the caller is a worker too
+	printf("software rasterizer: %d thread(s), %s\n", thread_count < 1 ? 1 : thread_count,
+#ifdef SOFTRAS_SSE2
+		"SSE2"
+#else
+		"scalar"
+#endif
+	);
+	return true;
+}
+
+inline void soft_rasterizer_t::finalize()
+{
+	{ std::lock_guard<std::mutex> lock(mutex); quit = true; }
+	wake.notify_all();
+	for (auto& t : threads) t.join();
+	threads.clear();
+}
+
+inline void soft_rasterizer_t::load_texture(texture_t& t, int width, int height, int channels, const uchar* data, uint version)
+{
+	// expand to RGBA8; one channel is coverage over white, as the HUD's swizzled glyph rows
+	// rows are 4-byte aligned, as uploaded with the default GL_UNPACK_ALIGNMENT
+	t.version = version;
+	t.level.assign(1, std::vector<uint>(size_t(width) * height));
+	t.size.assign(1, ivec2(width, height));
+	size_t row = (size_t(width) * channels + 3) & ~size_t(3);
+	for (int y = 0; y < height; y++)
+	{
+		uint* dst = &t.level[0][size_t(y) * width];
+		for (int x = 0; x < width; x++)
+		{
+			const uchar* s = data + y * row + x * channels;
+			if (channels == 1) dst[x] = 0x00ffffffu | (uint(s[0]) << 24);
+			else dst[x] = uint(s[0]) | (uint(s[1]) << 8) | (uint(s[2]) << 16) | (channels == 4 ? uint(s[3]) << 24 : 0xff000000u);
+		}
+	}
+
+	// box-filtered pyramid down to 1x1
+	while (t.size.back().x > 1 || t.size.back().y > 1)
+	{
+		ivec2 s = t.size.back(), d = ivec2(max(s.x / 2, 1), max(s.y / 2, 1));
+		std::vector<uint> next(size_t(d.x) * d.y);
+		const std::vector<uint>& src = t.level.back();
+		for (int y = 0; y < d.y; y++) for (int x = 0; x < d.x; x++)
+		{
+			int x0 = min(x * 2, s.x - 1), x1 = min(x * 2 + 1, s.x - 1), y0 = min(y * 2, s.y - 1), y1 = min(y * 2 + 1, s.y - 1);
+			uint c[4] = { src[y0 * s.x + x0], src[y0 * s.x + x1], src[y1 * s.x + x0], src[y1 * s.x + x1] }, r = 0;
+			for (int ch = 0; ch < 32; ch += 8) r |= (((c[0] >> ch & 0xff) + (c[1] >> ch & 0xff) + (c[2] >> ch & 0xff) + (c[3] >> ch & 0xff) + 2) / 4) << ch;
+			next[y * d.x + x] = r;
+		}
+		t.level.push_back(std::move(next));
+		t.size.push_back(d);
+	}
+}
+
+inline void soft_rasterizer_t::register_mesh(GLuint vertex_array, const vertex* v, size_t vertex_count, const uint* i, size_t index_count)
+{
+	mesh_t& m = meshes[vertex_array];
+	m.vertices.assign(v, v + vertex_count);
+	if (i) m.indices.assign(i, i + index_count); else m.indices.clear();
+}
+
+inline void soft_rasterizer_t::begin(ivec2 frame_size, vec4 clear)
+{
+	if (frame_size.x != size.x || frame_size.y != size.y)
+	{
+		size = frame_size;
+		tiles = ivec2((size.x + TILE - 1) / TILE, (size.y + TILE - 1) / TILE);
+		stride = tiles.x * TILE;
+		color.assign(size_t(stride) * tiles.y * TILE, 0);
+		depth.assign(size_t(stride) * tiles.y * TILE, 1.0f);
+		bins.assign(size_t(tiles.x) * tiles.y, std::vector<uint>());
+	}
+	auto to8 = [](float f) { return uint(clamp(f, 0.0f, 1.0f) * 255.0f + 0.5f); };
+	clear_color = to8(clear.r) | (to8(clear.g) << 8) | (to8(clear.b) << 16) | (to8(clear.a) << 24);
+	triangles.clear();
+	states.clear();
+	for (auto& b : bins) b.clear();
+}
+
+inline uint soft_rasterizer_t::add_state(GLuint texture, int layer, GLuint sampler, bool depth_test, bool depth_write)
+{
+	auto t = textures.find(texture_key(texture, layer));
+	if (t == textures.end()) return ~0u;
+	auto s = samplers.find(sampler);
+	state_t st = { &t->second, s == samplers.end() ? sampler_t() : s->second, depth_test, depth_write };
+	if (!states.empty() && states.back().texture == st.texture && states.back().sampler.repeat == st.sampler.repeat && states.back().sampler.mipmap == st.sampler.mipmap
+		&& states.back().depth_test == depth_test && states.back().depth_write == depth_write) return uint(states.size() - 1);
+	states.push_back(st);
+	return uint(states.size() - 1);
+}
+
+inline void soft_rasterizer_t::draw(const draw_item_t& item, const mat4& view_projection, bool depth_write)
+{
+	auto m = meshes.find(item.vertex_array);
+	if (m == meshes.end()) return;
+	uint state = add_state(item.texture, item.layer, item.sampler, true, depth_write);
+	if (state == ~0u) return;
+
+	// vertex shader: gl_Position = projection * view * model * position
+	mat4 mvp = view_projection * item.model_matrix;
+	const mesh_t& mesh = m->second;
+	std::vector<clip_vertex> cv(mesh.vertices.size());
+	for (size_t k = 0; k < cv.size(); k++) cv[k] = { mvp * vec4(mesh.vertices[k].pos, 1.0f), mesh.vertices[k].tex };
+
+	// items with a color are drawn with the TINT variant of frag_shader
+	vec4 tint = item.use_color ? item.color : vec4(1.0f);
+	auto index = [&](GLsizei k) { return mesh.indices.empty() ? item.first + uint(k) : mesh.indices[item.first + k] + uint(item.base_vertex); };
+	if (item.mode == GL_TRIANGLE_STRIP)
+	{
+		for (GLsizei k = 0; k + 2 < item.count; k++)
+		{
+			// odd triangles swap their first two vertices to keep the winding
+			uint a = index(k), b = index(k + 1), c = index(k + 2);
+			if (k & 1) std::swap(a, b);
+			add_triangle(cv[a], cv[b], cv[c], state, tint);
+		}
+	}
+	else for (GLsizei k = 0; k + 2 < item.count; k += 3) add_triangle(cv[index(k)], cv[index(k + 1)], cv[index(k + 2)], state, tint);
+}
+
+inline void soft_rasterizer_t::draw(const render_queue_t& queue, const mat4& view_projection)
+{
+	for (int pass = 0; pass < render_queue_t::PASS_NUM; pass++)
+		for (const render_queue_t::sort_t& s : queue.keys[pass]) draw(queue.items[s.index], view_projection, pass == render_queue_t::OPAQUE);
+}
+
+inline void soft_rasterizer_t::draw(const sprite_batch_t& batch, int layer)
+{
+	// sprite_vert: window pixels (y down) to clip space; no depth test
+	vec2 scale = vec2(2.0f / batch.viewport.x, -2.0f / batch.viewport.y);
+	for (const sprite_batch_t::run_t& r : batch.runs)
+	{
+		if (int(r.key >> 56) != layer) continue;
+		uint state = add_state(GLuint(r.key & 0xffffffff), -1, GLuint((r.key >> 32) & 0xffffff), false, false);
+		if (state == ~0u) continue;
+		for (uint q = r.first; q < r.first + r.count; q++)
+		{
+			const sprite_vertex* v = &batch.stream[q * 4];
+			clip_vertex c[4];
+			for (int k = 0; k < 4; k++) c[k] = { vec4(v[k].pos.x * scale.x - 1.0f, v[k].pos.y * scale.y + 1.0f, 0.0f, 1.0f), v[k].tex };
+			add_triangle(c[0], c[1], c[2], state, v[0].color);
+			add_triangle(c[2], c[3], c[0], state, v[0].color);
+		}
+	}
+}
+
+inline void soft_rasterizer_t::add_triangle(const clip_vertex& a, const clip_vertex& b, const clip_vertex& c, uint state, vec4 tint)
+{
+	// clip against the near plane (z >= -w); the other planes are handled by the pixel bounding box
+	const clip_vertex* in[3] = { &a, &b, &c };
+	clip_vertex out[4]; int n = 0;
+	for (int k = 0; k < 3; k++)
+	{
+		const clip_vertex& p = *in[k], & q = *in[(k + 1) % 3];
+		float dp = p.pos.z + p.pos.w, dq = q.pos.z + q.pos.w;
+		if (dp >= 0) out[n++] = p;
+		if ((dp >= 0) != (dq >= 0))
+		{
+			float t = dp / (dp - dq);
+			out[n++] = { p.pos + (q.pos - p.pos) * t, p.tex + (q.tex - p.tex) * t };
+		}
+	}
+
+	for (int k = 1; k + 1 < n; k++)
+	{
+		const clip_vertex* v[3] = { &out[0], &out[k], &out[k + 1] };
+		vec3 p[3]; vec2 t[3]; float w[3];
+		for (int j = 0; j < 3; j++)
+		{
+			// viewport transform to window coordinates (y up), depth range [0,1]
+			float iw = 1.0f / v[j]->pos.w;
+			p[j] = vec3((v[j]->pos.x * iw * 0.5f + 0.5f) * size.x, (v[j]->pos.y * iw * 0.5f + 0.5f) * size.y, v[j]->pos.z * iw * 0.5f + 0.5f);
+			t[j] = v[j]->tex;
+			w[j] = iw;
+		}
+		setup(p, t, w, state, tint);
+	}
+}
+
+inline void soft_rasterizer_t::setup(const vec3 p[3], const vec2 t[3], const float iw[3], uint state, vec4 tint)
+{
+	// counter-clockwise is front-facing; back faces and degenerate triangles are culled
+	float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[2].x - p[0].x) * (p[1].y - p[0].y);
+	if (!(area > 0.0f)) return;
+
+	triangle_t tri;
+	tri.lo = ivec2(max(int(floorf(min(min(p[0].x, p[1].x), p[2].x))), 0), max(int(floorf(min(min(p[0].y, p[1].y), p[2].y))), 0));
+	tri.hi = ivec2(min(int(ceilf(max(max(p[0].x, p[1].x), p[2].x))), size.x - 1), min(int(ceilf(max(max(p[0].y, p[1].y), p[2].y))), size.y - 1));
+	if (tri.lo.x > tri.hi.x || tri.lo.y > tri.hi.y) return;
+
+	// edge k is opposite vertex k; e_k(p_k) == area. the two triangles sharing an edge
+	// compute exactly negated coefficients, so the tie rule gives each pixel to one of them
+	for (int k = 0; k < 3; k++)
+	{
+		const vec3& a = p[(k + 1) % 3], & b = p[(k + 2) % 3];
+		tri.edge[k][0] = a.y - b.y;
+		tri.edge[k][1] = b.x - a.x;
+		tri.edge[k][2] = a.x * b.y - b.x * a.y;
+		tri.inclusive[k] = tri.edge[k][0] > 0 || (tri.edge[k][0] == 0 && tri.edge[k][1] < 0);
+	}
+	tri.inv_area = 1.0f / area;
+
+	for (int k = 0; k < 3; k++)
+	{
+		tri.z[k] = p[k].z;
+		tri.iw[k] = iw[k];
+		tri.uw[k] = t[k].x * iw[k];
+		tri.vw[k] = t[k].y * iw[k];
+	}
+	auto to8 = [](float f) { return uint(clamp(f, 0.0f, 1.0f) * 255.0f + 0.5f); };
+	tri.tint = to8(tint.r) | (to8(tint.g) << 8) | (to8(tint.b) << 16) | (to8(tint.a) << 24);
+	tri.tinted = tri.tint != 0xffffffffu;
+	tri.state = state;
+
+	// one mip level per triangle from the ratio of texel area to pixel area at level 0
+	const state_t& st = states[state];
+	tri.level = 0;
+	if (st.sampler.mipmap)
+	{
+		ivec2 ts = st.texture->size[0];
+		float tarea = fabsf((t[1].x - t[0].x) * (t[2].y - t[0].y) - (t[2].x - t[0].x) * (t[1].y - t[0].y)) * ts.x * ts.y;
+		float lod = 0.5f * log2f(max(tarea / area, 1e-8f));
+		tri.level = clamp(int(lod + 0.5f), 0, int(st.texture->level.size()) - 1);
+	}
+
+	uint index = uint(triangles.size());
+	triangles.push_back(tri);
+	for (int ty = tri.lo.y / TILE; ty <= tri.hi.y / TILE; ty++)
+		for (int tx = tri.lo.x / TILE; tx <= tri.hi.x / TILE; tx++) bins[ty * tiles.x + tx].push_back(index);
+}
+
+inline uint soft_rasterizer_t::sample(const uint* texels, ivec2 s, bool repeat, float u, float v)
+{
+	// bilinear fetch in 24.8 fixed point; texel rows are in upload order, so v=0 is the first row as in GL
+	if (repeat) { u -= float(ifloor(u)); v -= float(ifloor(v)); }
+	int fu = ifloor((u * s.x - 0.5f) * 256.0f), fv = ifloor((v * s.y - 0.5f) * 256.0f);
+	int x0 = fu >> 8, y0 = fv >> 8, x1 = x0 + 1, y1 = y0 + 1;
+	if (repeat)
+	{
+		// u is in [0,1), so only the first and the last texel wrap
+		if (x0 < 0) x0 = s.x - 1;
+		if (x1 >= s.x) x1 = 0;
+		if (y0 < 0) y0 = s.y - 1;
+		if (y1 >= s.y) y1 = 0;
+		if (x0 >= s.x) x0 = s.x - 1;	// u*s.x rounded up to s.x
+		if (y0 >= s.y) y0 = s.y - 1;
+	}
+	else
+	{
+		x0 = clamp(x0, 0, s.x - 1); x1 = clamp(x1, 0, s.x - 1);
+		y0 = clamp(y0, 0, s.y - 1); y1 = clamp(y1, 0, s.y - 1);
+	}
+	const uint* r0 = texels + y0 * s.x, * r1 = texels + y1 * s.x;
+	uint ax = fu & 0xff, ay = fv & 0xff;
+	return rgba_lerp(rgba_lerp(r0[x0], r0[x1], ax), rgba_lerp(r1[x0], r1[x1], ax), ay);
+}
+
+#ifdef SOFTRAS_SSE2
+inline void soft_rasterizer_t::shade4(uint* dst, int mask, const uint* texels, ivec2 s, bool repeat, float4 u, float4 v, bool tinted, uint tint)
+{
+	// sample(), the tint and the blend for four pixels, with the scalar path's integer math
+	// in 16-bit lanes (two pixels per register), so both paths write the same colors
+	__m128i zero = _mm_setzero_si128(), one = _mm_set1_epi32(1), mx = _mm_set1_epi32(s.x - 1), my = _mm_set1_epi32(s.y - 1);
+	__m128 uf = u.v, vf = v.v;
+	if (repeat) { uf = _mm_sub_ps(uf, _mm_cvtepi32_ps(ifloor(uf))); vf = _mm_sub_ps(vf, _mm_cvtepi32_ps(ifloor(vf))); }
+	__m128i fu = ifloor(_mm_mul_ps(_mm_sub_ps(_mm_mul_ps(uf, _mm_set1_ps(float(s.x))), _mm_set1_ps(0.5f)), _mm_set1_ps(256.0f)));
+	__m128i fv = ifloor(_mm_mul_ps(_mm_sub_ps(_mm_mul_ps(vf, _mm_set1_ps(float(s.y))), _mm_set1_ps(0.5f)), _mm_set1_ps(256.0f)));
+	__m128i x0 = _mm_srai_epi32(fu, 8), y0 = _mm_srai_epi32(fv, 8), x1 = _mm_add_epi32(x0, one), y1 = _mm_add_epi32(y0, one);
+	auto select = [](__m128i m, __m128i a, __m128i b) { return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b)); };
+	if (repeat)
+	{
+		x0 = select(_mm_cmplt_epi32(x0, zero), mx, x0); x1 = _mm_andnot_si128(_mm_cmpgt_epi32(x1, mx), x1); x0 = select(_mm_cmpgt_epi32(x0, mx), mx, x0);
+		y0 = select(_mm_cmplt_epi32(y0, zero), my, y0); y1 = _mm_andnot_si128(_mm_cmpgt_epi32(y1, my), y1); y0 = select(_mm_cmpgt_epi32(y0, my), my, y0);
+	}
+	else
+	{
+		x0 = select(_mm_cmpgt_epi32(x0, mx), mx, _mm_andnot_si128(_mm_cmplt_epi32(x0, zero), x0));
+		x1 = select(_mm_cmpgt_epi32(x1, mx), mx, _mm_andnot_si128(_mm_cmplt_epi32(x1, zero), x1));
+		y0 = select(_mm_cmpgt_epi32(y0, my), my, _mm_andnot_si128(_mm_cmplt_epi32(y0, zero), y0));
+		y1 = select(_mm_cmpgt_epi32(y1, my), my, _mm_andnot_si128(_mm_cmplt_epi32(y1, zero), y1));
+	}
+
+	// the four texels of each pixel; uncovered lanes may hold any coordinates, so they read texel 0
+	__m128i bits = _mm_setr_epi32(1, 2, 4, 8), m = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(mask), bits), bits);
+	alignas(16) int c[4][4];
+	_mm_store_si128((__m128i*)c[0], _mm_and_si128(m, x0)); _mm_store_si128((__m128i*)c[1], _mm_and_si128(m, x1));
+	_mm_store_si128((__m128i*)c[2], _mm_and_si128(m, y0)); _mm_store_si128((__m128i*)c[3], _mm_and_si128(m, y1));
+	const uint* r0[4] = { texels + c[2][0] * s.x, texels + c[2][1] * s.x, texels + c[2][2] * s.x, texels + c[2][3] * s.x };
+	const uint* r1[4] = { texels + c[3][0] * s.x, texels + c[3][1] * s.x, texels + c[3][2] * s.x, texels + c[3][3] * s.x };
+	__m128i t[4] = {	// row 0 left, row 0 right, row 1 left, row 1 right
+		_mm_setr_epi32(int(r0[0][c[0][0]]), int(r0[1][c[0][1]]), int(r0[2][c[0][2]]), int(r0[3][c[0][3]])),
+		_mm_setr_epi32(int(r0[0][c[1][0]]), int(r0[1][c[1][1]]), int(r0[2][c[1][2]]), int(r0[3][c[1][3]])),
+		_mm_setr_epi32(int(r1[0][c[0][0]]), int(r1[1][c[0][1]]), int(r1[2][c[0][2]]), int(r1[3][c[0][3]])),
+		_mm_setr_epi32(int(r1[0][c[1][0]]), int(r1[1][c[1][1]]), int(r1[2][c[1][2]]), int(r1[3][c[1][3]])) };
+
+	// weights as 16-bit lanes: ax0..ax3 ay0..ay3, then each repeated over a pixel's channels
+	__m128i m255 = _mm_set1_epi32(255), w = _mm_packs_epi32(_mm_and_si128(fu, m255), _mm_and_si128(fv, m255));
+	__m128i wx = _mm_unpacklo_epi16(w, w), wy = _mm_unpackhi_epi16(w, w);
+	auto lerp = [](__m128i a, __m128i b, __m128i f) { return _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(a, _mm_sub_epi16(_mm_set1_epi16(256), f)), _mm_mullo_epi16(b, f)), 8); };
+	auto widen = [&](__m128i p, int h) { return h ? _mm_unpackhi_epi8(p, zero) : _mm_unpacklo_epi8(p, zero); };
+	__m128i old = _mm_loadu_si128((const __m128i*)dst), tint16 = _mm_unpacklo_epi8(_mm_set1_epi32(int(tint)), zero), out[2];
+	for (int h = 0; h < 2; h++)
+	{
+		__m128i ax = h ? _mm_unpackhi_epi32(wx, wx) : _mm_unpacklo_epi32(wx, wx), ay = h ? _mm_unpackhi_epi32(wy, wy) : _mm_unpacklo_epi32(wy, wy);
+		__m128i top = lerp(widen(t[0], h), widen(t[1], h), ax);
+		__m128i bottom = lerp(widen(t[2], h), widen(t[3], h), ax);
+		__m128i src = lerp(top, bottom, ay);
+		if (tinted)
+		{
+			// (src * tint + 127) / 255, exact below 65536 - 255
+			__m128i p = _mm_add_epi16(_mm_mullo_epi16(src, tint16), _mm_set1_epi16(127));
+			src = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(p, _mm_set1_epi16(1)), _mm_srli_epi16(p, 8)), 8);
+		}
+		__m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(src, 0xff), 0xff);
+		out[h] = lerp(widen(old, h), src, _mm_add_epi16(a, _mm_srli_epi16(a, 7)));	// alpha 255 gives src, 0 keeps dst
+	}
+	_mm_storeu_si128((__m128i*)dst, select(m, _mm_packus_epi16(out[0], out[1]), old));
+}
+#endif
+
+inline void soft_rasterizer_t::shade_tile(int tile)
+{
+	int tx = tile % tiles.x, ty = tile / tiles.x;
+	ivec2 t0 = ivec2(tx * TILE, ty * TILE), t1 = ivec2(min(t0.x + TILE, size.x) - 1, min(t0.y + TILE, size.y) - 1);
+
+	for (int y = t0.y; y < t0.y + TILE; y++)
+	{
+		std::fill(&color[size_t(y) * stride + t0.x], &color[size_t(y) * stride + t0.x] + TILE, clear_color);
+		std::fill(&depth[size_t(y) * stride + t0.x], &depth[size_t(y) * stride + t0.x] + TILE, 1.0f);
+	}
+
+	for (uint index : bins[tile])
+	{
+		const triangle_t& tri = triangles[index];
+		const state_t& st = states[tri.state];
+		const uint* texels = &st.texture->level[tri.level][0];
+		ivec2 ts = st.texture->size[tri.level];
+		int x0 = max(tri.lo.x, t0.x) & ~3, x1 = min(tri.hi.x, t1.x), y0 = max(tri.lo.y, t0.y), y1 = min(tri.hi.y, t1.y);
+
+		for (int y = y0; y <= y1; y++)
+		{
+			// the span of the row where each edge can be non-negative, a pixel wider for rounding;
+			// it only skips empty quads, the coverage test below stays exact
+			float lo = float(x0), hi = float(x1);
+			for (int k = 0; k < 3; k++)
+			{
+				float a = tri.edge[k][0], r = tri.edge[k][1] * (float(y) + 0.5f) + tri.edge[k][2];
+				if (a > 0) lo = max(lo, -r / a - 1.5f);
+				else if (a < 0) hi = min(hi, -r / a + 0.5f);
+			}
+			if (lo > hi) continue;
+
+			float4 py(float(y) + 0.5f);
+			float* zrow = &depth[size_t(y) * stride];
+			uint* crow = &color[size_t(y) * stride];
+			for (int x = int(lo) & ~3, xe = int(hi); x <= xe; x += 4)
+			{
+				// coverage of four pixel centers; exact zeros go to the inclusive side only
+				float4 px = float4::ramp(float(x) + 0.5f);
+				float4 e[3];
+				int mask = (px < float4(float(x1) + 1.0f));
+				for (int k = 0; k < 3; k++)
+				{
+					e[k] = float4(tri.edge[k][0]) * px + float4(tri.edge[k][1]) * py + float4(tri.edge[k][2]);
+					mask &= tri.inclusive[k] ? (e[k] >= float4(0.0f)) : (e[k] > float4(0.0f));
+				}
+				if (!mask) continue;
+
+				// barycentrics, then depth test
+				float4 ia(tri.inv_area);
+				float4 b0 = e[0] * ia, b1 = e[1] * ia, b2 = e[2] * ia;
+				float4 z = b0 * float4(tri.z[0]) + b1 * float4(tri.z[1]) + b2 * float4(tri.z[2]);
+				if (st.depth_test) mask &= (z < float4::load(zrow + x));
+				if (!mask) continue;
+
+				// perspective-correct texture coordinates
+				float4 w = float4(1.0f) / (b0 * float4(tri.iw[0]) + b1 * float4(tri.iw[1]) + b2 * float4(tri.iw[2]));
+				float4 u = (b0 * float4(tri.uw[0]) + b1 * float4(tri.uw[1]) + b2 * float4(tri.uw[2])) * w;
+				float4 v = (b0 * float4(tri.vw[0]) + b1 * float4(tri.vw[1]) + b2 * float4(tri.vw[2])) * w;
+
+				// fetch and blend the covered lanes: dst + (src - dst) * alpha
+#ifdef SOFTRAS_SSE2
+				shade4(crow + x, mask, texels, ts, st.sampler.repeat, u, v, tri.tinted, tri.tint);
+#else
+				for (int k = 0; k < 4; k++)
+				{
+					if (!(mask & (1 << k))) continue;
+					uint src = sample(texels, ts, st.sampler.repeat, u.v[k], v.v[k]);
+					if (tri.tinted) src = rgba_modulate(src, tri.tint);
+					uint a = src >> 24;
+					if (!a) continue;	// no color change; depth is still written below, as in GL
+					crow[x + k] = a == 255 ? src : rgba_lerp(crow[x + k], src, a + (a >> 7));
+				}
+#endif
+				if (st.depth_write)
+				{
+					alignas(16) float zs[4]; z.store(zs);
+					for (int k = 0; k < 4; k++) if (mask & (1 << k)) zrow[x + k] = zs[k];
+				}
+			}
+		}
+	}
+}
+
+inline void soft_rasterizer_t::work()
+{
+	PROFILE_ZONE("shade tiles");
+	for (int tile; (tile = next_tile.fetch_add(1)) < tiles.x * tiles.y;) shade_tile(tile);
+}
+
+inline void soft_rasterizer_t::run()
+{
+	PROFILE_THREAD("rasterizer");
+	uint seen = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&] { return quit || generation != seen; });
+			if (quit) return;
+			seen = generation;
+		}
+		work();
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--busy == 0) done.notify_one();
+	}
+}
+
+inline void soft_rasterizer_t::resolve()
+{
+	next_tile = 0;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		generation++;
+		busy = int(threads.size());
+	}
+	wake.notify_all();
+	work();
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [&] { return busy == 0; });
+}
+
+inline bool soft_rasterizer_t::write(const char* path) const
+{
+	// RGB from the bottom-up buffer, top row first
+	std::vector<uchar> rgb(size_t(size.x) * size.y * 3);
+	for (int y = 0; y < size.y; y++)
+	{
+		const uint* src = &color[size_t(size.y - 1 - y) * stride];
+		uchar* dst = &rgb[size_t(y) * size.x * 3];
+		for (int x = 0; x < size.x; x++) { dst[x * 3 + 0] = uchar(src[x]); dst[x * 3 + 1] = uchar(src[x] >> 8); dst[x * 3 + 2] = uchar(src[x] >> 16); }
+	}
+	if (!stbi_write_png(path, size.x, size.y, 3, &rgb[0], size.x * 3)) { printf("%s(): failed to write %s\n", __func__, path); return false; }
+	return true;
+}
+
+#endif
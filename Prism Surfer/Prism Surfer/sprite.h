@@ -0,0 +1,145 @@
+#ifndef __SPRITE_H__
+#define __SPRITE_H__
+#pragma once
+
+#include "cgmath.h"
+#include "cgut.h"
+#include "glstate.h"
+
+// screen-space quad vertex; position in window pixels (x right, y down)
+struct sprite_vertex
+{
+	vec2 pos;
+	vec2 tex;
+	vec4 color;
+};
+
+// orthographic 2D sprite batcher: every screen-space quad of a frame goes into
+// one vertex stream, sorted by (layer, sampler, texture), so each layer costs one
+// draw per distinct texture regardless of how many quads it holds.
+// - order among different textures within a layer is not preserved; use layers for that.
+struct sprite_batch_t
+{
+	enum { BACKGROUND, COMPOSITE, PANEL, OVERLAY, LAYER_NUM };	// COMPOSITE: offscreen passes brought back onto the backbuffer; PANEL: under the OVERLAY text
+	static constexpr uint MAX_QUADS = 4096;		// keeps indices in 16 bits
+
+	struct run_t { uint64_t key; uint first, count; };	// quads of one (layer, sampler, texture)
+
+	GLuint	program = 0;
+	GLuint	vertex_buffer = 0;
+	GLuint	index_buffer = 0;
+	GLuint	vertex_array = 0;
+	GLint	screen_size = -1;			// uniform location
+	ivec2	viewport;
+	ivec2	screen_size_value;			// the screen_size uniform as last set
+
+	std::vector<sprite_vertex>	vertices;	// submission order
+	std::vector<run_t>			runs;		// one per submission, merged after sorting
+	std::vector<sprite_vertex>	stream;		// sorted vertices uploaded to the GPU
+
+	bool init(const char* vert_source, const char* frag_source);
+	void locate();	// once the program has linked: uniform locations, and TEX on unit 0
+	void finalize();
+	void begin(ivec2 window_size) { viewport = window_size; vertices.clear(); runs.clear(); }
+	void add(int layer, GLuint texture, GLuint sampler, vec2 p0, vec2 p1, vec2 t0, vec2 t1, vec4 color = vec4(1.0f));
+	void add(int layer, GLuint texture, GLuint sampler, const sprite_vertex* quads, uint quad_count);
+	void upload();
+	void draw(int layer);
+};
+
+inline bool sprite_batch_t::init(const char* vert_source, const char* frag_source)
+{
+	render_device_t& rd = render_device_t::current();
+	if (!(program = rd.create_program(vert_source, frag_source))) return false;
+
+	// static index buffer shared by all quads
+	std::vector<ushort> ilist; ilist.reserve(MAX_QUADS * 6);
+	for (uint k = 0; k < MAX_QUADS; k++) { uint b = k * 4; for (uint i : { 0, 1, 2, 2, 3, 0 }) ilist.push_back(ushort(b + i)); }
+
+	// the vertex buffer gets its storage with the first upload
+	static const vertex_attrib_t attribs[] = { { 0, 2, GLsizei(offsetof(sprite_vertex, pos)) }, { 1, 2, GLsizei(offsetof(sprite_vertex, tex)) }, { 2, 4, GLsizei(offsetof(sprite_vertex, color)) } };
+	vertex_buffer = rd.create_buffer(GL_ARRAY_BUFFER, 0, nullptr, GL_STREAM_DRAW);
+	index_buffer = rd.create_buffer(GL_ELEMENT_ARRAY_BUFFER, sizeof(ushort) * ilist.size(), &ilist[0], GL_STATIC_DRAW);
+	vertex_array = rd.create_vertex_array(vertex_buffer, index_buffer, attribs, 3, sizeof(sprite_vertex));
+	return true;
+}
+
+inline void sprite_batch_t::locate()
+{
+	render_device_t& rd = render_device_t::current();
+	rd.use_program(program);
+	GLint uloc = rd.uniform_location(program, "TEX"); if (uloc > -1) rd.uniform1i(uloc, 0);
+	screen_size = rd.uniform_location(program, "screen_size");
+}
+
+inline void sprite_batch_t::finalize()
+{
+	render_device_t& rd = render_device_t::current();
+	rd.destroy(render_device_t::BUFFER, vertex_buffer);
+	rd.destroy(render_device_t::BUFFER, index_buffer);
+	rd.destroy(render_device_t::VERTEX_ARRAY, vertex_array);
+	rd.destroy(render_device_t::PROGRAM, program);
+}
+
+inline void sprite_batch_t::add(int layer, GLuint texture, GLuint sampler, vec2 p0, vec2 p1, vec2 t0, vec2 t1, vec4 color)
+{
+	// p0/t0: top-left corner, p1/t1: bottom-right corner
+	sprite_vertex q[4] = { { p0, t0, color }, { vec2(p0.x, p1.y), vec2(t0.x, t1.y), color }, { p1, t1, color }, { vec2(p1.x, p0.y), vec2(t1.x, t0.y), color } };
+	add(layer, texture, sampler, q, 1);
+}
+
+inline void sprite_batch_t::add(int layer, GLuint texture, GLuint sampler, const sprite_vertex* quads, uint quad_count)
+{
+	if (!quad_count) return;
+	uint first = uint(vertices.size() / 4);
+	if (first + quad_count > MAX_QUADS) { printf("%s(): more than %u quads in a frame\n", __func__, MAX_QUADS); return; }
+	vertices.insert(vertices.end(), quads, quads + quad_count * 4);
+	runs.push_back({ (uint64_t(layer) << 56) | (uint64_t(sampler & 0xffffff) << 32) | texture, first, quad_count });
+}
+
+inline void sprite_batch_t::upload()
+{
+	// stable sort keeps submission order within a (layer, texture) run
+	std::stable_sort(runs.begin(), runs.end(), [](const run_t& a, const run_t& b) { return a.key < b.key; });
+
+	// gather into the upload stream, merging runs with the same key
+	stream.clear();
+	std::vector<run_t> merged;
+	for (const run_t& r : runs)
+	{
+		uint first = uint(stream.size() / 4);
+		stream.insert(stream.end(), vertices.begin() + r.first * 4, vertices.begin() + (r.first + r.count) * 4);
+		if (!merged.empty() && merged.back().key == r.key) merged.back().count += r.count;
+		else merged.push_back({ r.key, first, r.count });
+	}
+	runs.swap(merged);
+	if (stream.empty()) return;
+
+	// orphan the previous frame's storage instead of waiting on it
+	render_device_t& rd = render_device_t::current();
+	gl_state_t::instance().bind_array_buffer(vertex_buffer);
+	rd.buffer_data(GL_ARRAY_BUFFER, sizeof(sprite_vertex) * stream.size(), nullptr, GL_STREAM_DRAW);
+	rd.buffer_sub_data(GL_ARRAY_BUFFER, 0, sizeof(sprite_vertex) * stream.size(), &stream[0]);
+}
+
+inline void sprite_batch_t::draw(int layer)
+{
+	auto it = std::lower_bound(runs.begin(), runs.end(), uint64_t(layer) << 56, [](const run_t& r, uint64_t k) { return r.key < k; });
+	if (it == runs.end() || int(it->key >> 56) != layer) return;
+
+	gl_state_t& gs = gl_state_t::instance();
+	gs.use_program(program);
+	if (screen_size > -1 && (screen_size_value.x != viewport.x || screen_size_value.y != viewport.y)) { gs.uniform2(screen_size, vec2(float(viewport.x), float(viewport.y))); screen_size_value = viewport; }
+	gs.bind_vertex_array(vertex_array);
+	gs.enable(gl_state_t::DEPTH_TEST, false);
+	gs.enable(gl_state_t::BLEND, layer != COMPOSITE);	// an offscreen pass comes back opaque: its alpha is what blending left there
+	for (; it != runs.end() && int(it->key >> 56) == layer; ++it)
+	{
+		gs.bind_sampler(GLuint((it->key >> 32) & 0xffffff));
+		gs.bind_texture(GLuint(it->key & 0xffffffff));
+		gs.draw_elements(GL_TRIANGLES, it->count * 6, GL_UNSIGNED_SHORT, sizeof(ushort) * it->first * 6);
+	}
+	gs.enable(gl_state_t::DEPTH_TEST, true);
+}
+
+#endif
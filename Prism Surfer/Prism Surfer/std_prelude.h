@@ -0,0 +1,17 @@
+#ifndef __STD_PRELUDE_H__
+#define __STD_PRELUDE_H__
+#pragma once
+
+// standard headers the engine modules use that declare min()/max() members or call
+// std::min/max themselves; cgmath.h defines min and max as macros, so these have to be
+// seen first. include this ahead of cgmath.h in every translation unit.
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#endif
@@ -0,0 +1,226 @@
+#ifndef __TEXTURE_COOKER_H__
+#define __TEXTURE_COOKER_H__
+#pragma once
+
+#include "cgmath.h"
+#include "cgut.h"
+#include "render_device.h"
+#include <string>
+#include <sys/stat.h>
+#if defined(_WIN32)
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <unistd.h>
+#endif
+
+// assume stb_image.h included with STB_IMAGE_IMPLEMENTATION before this header
+
+// read-only view of a whole file, mapped rather than read
+struct mapped_file_t
+{
+	const uchar*	data = nullptr;
+	size_t			size = 0;
+
+	mapped_file_t() = default;
+	mapped_file_t(const mapped_file_t&) = delete;
+	mapped_file_t& operator=(const mapped_file_t&) = delete;
+	~mapped_file_t() { close(); }
+
+	bool open(const char* path);
+	void close();
+
+protected:
+#if defined(_WIN32)
+	HANDLE	file = INVALID_HANDLE_VALUE, mapping = nullptr;
+#endif
+};
+
+inline bool mapped_file_t::open(const char* path)
+{
+	close();
+#if defined(_WIN32)
+	file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER n; if (!GetFileSizeEx(file, &n) || !n.QuadPart) { close(); return false; }
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping) data = (const uchar*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!data) { close(); return false; }
+	size = size_t(n.QuadPart);
+#else
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+	{
+		void* p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED) { data = (const uchar*)p; size = size_t(st.st_size); }
+	}
+	::close(fd);	// the mapping keeps the file
+	if (!data) return false;
+#endif
+	return true;
+}
+
+inline void mapped_file_t::close()
+{
+#if defined(_WIN32)
+	if (data) UnmapViewOfFile(data);
+	if (mapping) CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+	mapping = nullptr; file = INVALID_HANDLE_VALUE;
+#else
+	if (data) munmap((void*)data, size);
+#endif
+	data = nullptr; size = 0;
+}
+
+// cooked texture (.ptex): a source image in the form the GPU takes it, made once
+// by cook_texture() so that loading is a file mapping and one upload.
+// - pixels follow the header: all mip levels down to 1x1, laid out as
+//   render_device_t::create_texture_levels() takes them (rows bottom-up, 4-byte aligned).
+// - the source's size and modification time are kept, so a stale file is recooked.
+// - a texture cooked to a fixed size (e.g., a layer of an array) is resampled to it.
+struct cooked_texture_t
+{
+	struct header_t
+	{
+		char		magic[8];		// "PSTEX001"
+		uint		width, height, channels, levels;
+		uint64_t	source_size;
+		int64_t		source_time;
+		uint64_t	data_size;		// bytes of pixels after the header
+	};
+
+	mapped_file_t	file;				// unused for a view into memory held elsewhere
+	const header_t*	header = nullptr;
+
+	bool open(const char* path, const char* source = nullptr, int channels = 0, ivec2 fit = ivec2(0, 0));	// fails on a stale or mismatched file
+	bool view(const uchar* data, size_t size, int channels = 0, ivec2 fit = ivec2(0, 0));	// fit: the size required, if any
+	ivec2 size() const { return ivec2(int(header->width), int(header->height)); }
+	int channels() const { return int(header->channels); }
+	int levels() const { return int(header->levels); }
+	const uchar* pixels() const { return (const uchar*)(header + 1); }
+};
+
+inline bool source_stat(const char* path, uint64_t& size, int64_t& time)
+{
+	struct stat st;
+	if (stat(path, &st) != 0) return false;
+	size = uint64_t(st.st_size); time = int64_t(st.st_mtime);
+	return true;
+}
+
+inline bool cooked_texture_t::view(const uchar* data, size_t size, int ch, ivec2 fit)
+{
+	const header_t* h = (const header_t*)data;
+	header = nullptr;
+	if (!data || size < sizeof(header_t) || memcmp(h->magic, "PSTEX001", 8) != 0 || !h->levels || (ch && h->channels != uint(ch))) return false;
+	if (fit.x > 0 && (h->width != uint(fit.x) || h->height != uint(fit.y))) return false;
+	if (h->data_size != render_device_t::texture_bytes(ivec2(int(h->width), int(h->height)), int(h->channels), int(h->levels)) || size < sizeof(header_t) + h->data_size) return false;
+	header = h;
+	return true;
+}
+
+inline bool cooked_texture_t::open(const char* path, const char* source, int ch, ivec2 fit)
+{
+	uint64_t ssize; int64_t stime;
+	if (!file.open(path)) return false;
+	bool valid = view(file.data, file.size, ch, fit);
+	if (valid && source && source_stat(source, ssize, stime)) valid = header->source_size == ssize && header->source_time == stime;
+	if (!valid) { file.close(); header = nullptr; }
+	return valid;
+}
+
+// bilinear resampling of a tightly packed image, texel centers aligned and edges clamped
+inline std::vector<uchar> resample_image(const uchar* src, ivec2 from, ivec2 to, int channels)
+{
+	std::vector<uchar> dst(size_t(to.x) * to.y * channels);
+	for (int y = 0; y < to.y; y++)
+	{
+		float fy = clamp((y + 0.5f) * from.y / to.y - 0.5f, 0.0f, float(from.y - 1));
+		int y0 = int(fy), y1 = min(y0 + 1, from.y - 1); float ty = fy - y0;
+		for (int x = 0; x < to.x; x++)
+		{
+			float fx = clamp((x + 0.5f) * from.x / to.x - 0.5f, 0.0f, float(from.x - 1));
+			int x0 = int(fx), x1 = min(x0 + 1, from.x - 1); float tx = fx - x0;
+			for (int c = 0; c < channels; c++)
+			{
+				auto at = [&](int i, int j) { return float(src[(size_t(j) * from.x + i) * channels + c]); };
+				float v = (at(x0, y0) * (1 - tx) + at(x1, y0) * tx) * (1 - ty) + (at(x0, y1) * (1 - tx) + at(x1, y1) * tx) * ty;
+				dst[(size_t(y) * to.x + x) * channels + c] = uchar(v + 0.5f);
+			}
+		}
+	}
+	return dst;
+}
+
+// decodes a source image into the channels the game samples (3, or 4 with alpha),
+// resamples it to fit when given, flips it bottom-up, builds the mip chain with the
+// software rasterizer's box filter, and writes the result to output
+inline bool cook_texture(const char* source, bool alpha, const char* output, ivec2 fit = ivec2(0, 0))
+{
+	int w, h, n, channels = alpha ? 4 : 3;
+	uchar* image = stbi_load(source, &w, &h, &n, channels);
+	if (!image) { printf("%s(): unable to decode %s\n", __func__, source); return false; }
+	std::vector<uchar> resampled;
+	if (fit.x > 0 && (fit.x != w || fit.y != h))
+	{
+		resampled = resample_image(image, ivec2(w, h), fit, channels);
+		stbi_image_free(image);
+		image = &resampled[0]; w = fit.x; h = fit.y;
+	}
+
+	ivec2 size(w, h);
+	int levels = render_device_t::level_count(size);
+	std::vector<uchar> pixels(render_device_t::texture_bytes(size, channels, levels));
+
+	size_t row = size_t(w) * channels, stride = (row + 3) & ~size_t(3);
+	for (int y = 0; y < h; y++) memcpy(&pixels[(h - 1 - y) * stride], image + y * row, row);
+	if (resampled.empty()) stbi_image_free(image);
+
+	uchar* src = &pixels[0];
+	for (int k = 1; k < levels; k++)
+	{
+		ivec2 s = render_device_t::level_size(size, k - 1), d = render_device_t::level_size(size, k);
+		size_t ss = render_device_t::texture_bytes(ivec2(s.x, 1), channels, 1), ds = render_device_t::texture_bytes(ivec2(d.x, 1), channels, 1);
+		uchar* dst = src + ss * s.y;
+		for (int y = 0; y < d.y; y++) for (int x = 0; x < d.x; x++)
+		{
+			int x0 = min(x * 2, s.x - 1), x1 = min(x * 2 + 1, s.x - 1), y0 = min(y * 2, s.y - 1), y1 = min(y * 2 + 1, s.y - 1);
+			for (int c = 0; c < channels; c++)
+				dst[y * ds + x * channels + c] = uchar((src[y0 * ss + x0 * channels + c] + src[y0 * ss + x1 * channels + c] + src[y1 * ss + x0 * channels + c] + src[y1 * ss + x1 * channels + c] + 2) / 4);
+		}
+		src = dst;
+	}
+
+	cooked_texture_t::header_t header = { { 'P', 'S', 'T', 'E', 'X', '0', '0', '1' }, uint(w), uint(h), uint(channels), uint(levels), 0, 0, pixels.size() };
+	source_stat(source, header.source_size, header.source_time);
+
+	FILE* fp = fopen(output, "wb");
+	if (!fp) { printf("%s(): unable to create %s\n", __func__, output); return false; }
+	bool b = fwrite(&header, sizeof(header), 1, fp) == 1 && fwrite(&pixels[0], pixels.size(), 1, fp) == 1;
+	b = fclose(fp) == 0 && b;
+	if (!b) { printf("%s(): unable to write %s\n", __func__, output); remove(output); }
+	return b;
+}
+
+// the cooked file of a source: its path with the extension replaced by .ptex
+inline std::string cooked_path(const char* source)
+{
+	std::string p = source;
+	size_t dot = p.find_last_of('.'), slash = p.find_last_of("/\\");
+	if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) p.resize(dot);
+	return p + ".ptex";
+}
+
+// opens the cooked form of a source image, cooking it first when missing, stale or of another size than fit
+inline bool open_cooked_texture(cooked_texture_t& t, const char* source, bool alpha, ivec2 fit = ivec2(0, 0))
+{
+	std::string path = cooked_path(source);
+	if (t.open(path.c_str(), source, alpha ? 4 : 3, fit)) return true;
+	return cook_texture(source, alpha, path.c_str(), fit) && t.open(path.c_str(), source, alpha ? 4 : 3, fit);
+}
+
+#endif